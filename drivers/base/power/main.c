@@ -26,6 +26,9 @@
 #include <linux/rwsem.h>
 #include <linux/interrupt.h>
 #include <linux/timer.h>
+#include <linux/suspend.h>
+#include <linux/ktime.h>
+#include <trace/events/power.h>
 
 #include "../base.h"
 #include "power.h"
@@ -53,6 +56,8 @@ static DEFINE_TIMER(dpm_drv_wd, dpm_drv_timeout, 0, 0);
  */
 static bool transition_started;
 
+struct suspend_stats suspend_stats;
+
 /**
  * device_pm_init - Initialize the PM-related part of a device object.
  * @dev: Device object being initialized.
@@ -474,6 +479,32 @@ static void dpm_drv_wdclr(struct device *dev)
 	del_timer_sync(&dpm_drv_wd);
 }
 
+/**
+ *	dpm_record_time - Account the time spent in a device's callback.
+ *	@dev: Device whose callback was executed.
+ *	@state: PM transition of the system being carried out.
+ *	@starttime: When the callback was started.
+ *	@error: What the callback returned.
+ *	@resume: Whether it was a resume callback.
+ *
+ * Remember the slowest device of the transition for /proc/suspend_stats.
+ */
+static void dpm_record_time(struct device *dev, pm_message_t state,
+			    ktime_t starttime, int error, bool resume)
+{
+	s64 usecs = ktime_to_us(ktime_sub(ktime_get(), starttime));
+	s64 *slowest = resume ? &suspend_stats.slowest_resume_us :
+				&suspend_stats.slowest_suspend_us;
+	char *name = resume ? suspend_stats.slowest_resume_dev :
+			      suspend_stats.slowest_suspend_dev;
+
+	trace_device_pm_callback(dev, state.event, usecs, error);
+	if (usecs > *slowest) {
+		*slowest = usecs;
+		strlcpy(name, dev_name(dev), SUSPEND_STATS_NAME_LEN);
+	}
+}
+
 /**
  * dpm_resume - Execute "resume" callbacks for non-sysdev devices.
  * @state: PM transition of the system being carried out.
@@ -486,18 +517,22 @@ static void dpm_resume(pm_message_t state)
 	struct list_head list;
 
 	INIT_LIST_HEAD(&list);
+	suspend_stats.slowest_resume_us = 0;
+	suspend_stats.slowest_resume_dev[0] = '\0';
 	mutex_lock(&dpm_list_mtx);
 	while (!list_empty(&dpm_list)) {
 		struct device *dev = to_device(dpm_list.next);
 
 		get_device(dev);
 		if (dev->power.status >= DPM_OFF) {
+			ktime_t starttime = ktime_get();
 			int error;
 
 			dev->power.status = DPM_RESUMING;
 			mutex_unlock(&dpm_list_mtx);
 
 			error = device_resume(dev, state);
+			dpm_record_time(dev, state, starttime, error, true);
 
 			mutex_lock(&dpm_list_mtx);
 			if (error)
@@ -655,6 +690,8 @@ int dpm_suspend_noirq(pm_message_t state)
 		error = device_suspend_noirq(dev, state);
 		if (error) {
 			pm_dev_err(dev, state, " late", error);
+			strlcpy(suspend_stats.failed_dev, dev_name(dev),
+				SUSPEND_STATS_NAME_LEN);
 			break;
 		}
 		dev->power.status = DPM_OFF_IRQ;
@@ -725,20 +762,27 @@ static int dpm_suspend(pm_message_t state)
 	int error = 0;
 
 	INIT_LIST_HEAD(&list);
+	suspend_stats.slowest_suspend_us = 0;
+	suspend_stats.slowest_suspend_dev[0] = '\0';
 	mutex_lock(&dpm_list_mtx);
 	while (!list_empty(&dpm_list)) {
 		struct device *dev = to_device(dpm_list.prev);
+		ktime_t starttime;
 
 		get_device(dev);
 		mutex_unlock(&dpm_list_mtx);
 
 		dpm_drv_wdset(dev);
+		starttime = ktime_get();
 		error = device_suspend(dev, state);
+		dpm_record_time(dev, state, starttime, error, false);
 		dpm_drv_wdclr(dev);
 
 		mutex_lock(&dpm_list_mtx);
 		if (error) {
 			pm_dev_err(dev, state, "", error);
+			strlcpy(suspend_stats.failed_dev, dev_name(dev),
+				SUSPEND_STATS_NAME_LEN);
 			put_device(dev);
 			break;
 		}
@@ -126,13 +126,13 @@ static long kgsl_cache_range_op(unsigned long addr, int size,
 	return 0;
 }
 
+/* called without the driver lock, see kgsl_ioctl */
 static long kgsl_clean_cache_all(struct kgsl_file_private *private)
 {
 	int result = 0;
 	struct kgsl_mem_entry *entry = NULL;
 
-	kgsl_runpending_all();
-
+	mutex_lock(&private->mem_lock);
 	list_for_each_entry(entry, &private->mem_list, list) {
 		if (KGSL_MEMFLAGS_CACHE_MASK & entry->memdesc.priv) {
 			result =
@@ -145,6 +145,7 @@ static long kgsl_clean_cache_all(struct kgsl_file_private *private)
 		}
 	}
 done:
+	mutex_unlock(&private->mem_lock);
 	return result;
 }
 #endif /*CONFIG_MSM_KGSL_MMU*/
@@ -446,8 +447,10 @@ kgsl_get_process_private(struct kgsl_device_private *cur_dev_priv)
 	private = kzalloc(sizeof(struct kgsl_file_private), GFP_KERNEL);
 	if (private == NULL)
 		KGSL_DRV_ERR("Error: cannot allocate process private data\n");
-	else
+	else {
 		private->refcnt = 1;
+		mutex_init(&private->mem_lock);
+	}
 	return private;
 }
 
@@ -886,12 +889,16 @@ done:
 
 void kgsl_remove_mem_entry(struct kgsl_mem_entry *entry, bool preserve)
 {
+	struct kgsl_file_private *private = entry->priv;
+
+	mutex_lock(&private->mem_lock);
+
 	/* If allocation is vmalloc and preserve is requested then save
 	* the allocation in a free list to be used later instead of
 	* freeing it here */
 	if (KGSL_MEMFLAGS_VMALLOC_MEM & entry->memdesc.priv &&
 		preserve &&
-		entry->priv->preserve_list_size < KGSL_MAX_PRESERVED_BUFFERS &&
+		private->preserve_list_size < KGSL_MAX_PRESERVED_BUFFERS &&
 		entry->memdesc.size <= KGSL_MAX_SIZE_OF_PRESERVED_BUFFER) {
 		if (entry->free_list.prev) {
 			list_del(&entry->free_list);
@@ -901,8 +908,9 @@ void kgsl_remove_mem_entry(struct kgsl_mem_entry *entry, bool preserve)
 			list_del(&entry->list);
 			entry->list.prev = NULL;
 		}
-		list_add(&entry->list, &entry->priv->preserve_entry_list);
-		entry->priv->preserve_list_size++;
+		list_add(&entry->list, &private->preserve_entry_list);
+		private->preserve_list_size++;
+		mutex_unlock(&private->mem_lock);
 		return;
 	}
 	kgsl_mmu_unmap(entry->memdesc.pagetable,
@@ -910,9 +918,13 @@ void kgsl_remove_mem_entry(struct kgsl_mem_entry *entry, bool preserve)
 			entry->memdesc.size);
 	if (KGSL_MEMFLAGS_VMALLOC_MEM & entry->memdesc.priv) {
 		vfree((void *)entry->memdesc.physaddr);
-		entry->priv->vmalloc_size -= entry->memdesc.size;
-	} else
+		private->vmalloc_size -= entry->memdesc.size;
+		private->stats.vmalloc_count--;
+	} else {
 		kgsl_put_phys_file(entry->pmem_file);
+		private->stats.pmem_count--;
+		private->stats.pmem_size -= entry->memdesc.size;
+	}
 
 	/* remove the entry from list and free_list if it exists */
 	if (entry->list.prev)
@@ -920,6 +932,7 @@ void kgsl_remove_mem_entry(struct kgsl_mem_entry *entry, bool preserve)
 	if (entry->free_list.prev)
 		list_del(&entry->free_list);
 
+	mutex_unlock(&private->mem_lock);
 	kfree(entry);
 
 }
@@ -999,14 +1012,17 @@ static long kgsl_ioctl_sharedmem_from_vmalloc(struct kgsl_file_private *private,
 		goto error;
 	}
 
+	mutex_lock(&private->mem_lock);
 	list_for_each_entry_safe(entry, entry_tmp,
 				&private->preserve_entry_list, list) {
 		if (entry->memdesc.size == len) {
 			list_del(&entry->list);
+			private->preserve_list_size--;
 			found = 1;
 			break;
 		}
 	}
+	mutex_unlock(&private->mem_lock);
 
 	if (!found) {
 		entry = kzalloc(sizeof(struct kgsl_mem_entry), GFP_KERNEL);
@@ -1045,7 +1061,6 @@ static long kgsl_ioctl_sharedmem_from_vmalloc(struct kgsl_file_private *private,
 	} else {
 		KGSL_MEM_INFO("Reusing memory entry: %x, size: %x\n",
 				(unsigned int)entry, entry->memdesc.size);
-		entry->priv->preserve_list_size--;
 		vmalloc_area = (void *)entry->memdesc.physaddr;
 	}
 
@@ -1066,7 +1081,17 @@ static long kgsl_ioctl_sharedmem_from_vmalloc(struct kgsl_file_private *private,
 		result = -EFAULT;
 		goto error_unmap_entry;
 	}
+	mutex_lock(&private->mem_lock);
 	list_add(&entry->list, &private->mem_list);
+	mutex_unlock(&private->mem_lock);
+
+	if (found) {
+		private->stats.vmalloc_reused++;
+	} else {
+		private->stats.vmalloc_count++;
+		if (private->vmalloc_size > private->stats.vmalloc_max)
+			private->stats.vmalloc_max = private->vmalloc_size;
+	}
 
 	return 0;
 
@@ -1165,6 +1190,7 @@ static int kgsl_ioctl_sharedmem_from_pmem(struct kgsl_file_private *private,
 	}
 
 	entry->pmem_file = pmem_file;
+	entry->priv = private;
 
 	entry->memdesc.pagetable = private->pagetable;
 
@@ -1190,7 +1216,11 @@ static int kgsl_ioctl_sharedmem_from_pmem(struct kgsl_file_private *private,
 		result = -EFAULT;
 		goto error_unmap_entry;
 	}
+	mutex_lock(&private->mem_lock);
 	list_add(&entry->list, &private->mem_list);
+	mutex_unlock(&private->mem_lock);
+	private->stats.pmem_count++;
+	private->stats.pmem_size += entry->memdesc.size;
 	return result;
 
 error_unmap_entry:
@@ -1253,6 +1283,14 @@ static long kgsl_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
 
 	KGSL_DRV_VDBG("filep %p cmd 0x%08x arg 0x%08lx\n", filep, cmd, arg);
 
+#ifdef CONFIG_MSM_KGSL_MMU
+	/* cleaning the caches only needs the process memory list, do it
+	 * before taking the driver lock so that submissions from other
+	 * processes are not held up behind it */
+	if (cmd == IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS && kgsl_cache_enable)
+		kgsl_clean_cache_all(dev_priv->process_priv);
+#endif
+
 	KGSL_PRE_HWACCESS();
 	switch (cmd) {
 
@@ -1274,10 +1312,6 @@ static long kgsl_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
 		break;
 
 	case IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS:
-#ifdef CONFIG_MSM_KGSL_MMU
-		if (kgsl_cache_enable)
-			kgsl_clean_cache_all(dev_priv->process_priv);
-#endif
 #ifdef CONFIG_MSM_KGSL_DRM
 		kgsl_gpu_mem_flush(DRM_KGSL_GEM_CACHE_OP_TO_DEV);
 #endif
@@ -1503,6 +1537,7 @@ static int kgsl_add_device(int dev_idx)
 	}
 	err = KGSL_SUCCESS;
 	atomic_set(&device->open_count, -1);
+	INIT_WORK(&device->memqueue_ws, kgsl_cmdstream_memqueue_work);
 
  done:
 	return err;
@@ -73,11 +73,9 @@ void kgsl_cmdstream_memqueue_drain(struct kgsl_device *device)
 					device,
 					KGSL_TIMESTAMP_RETIRED);
 
+	/* the queue is sorted by timestamp, stop at the first entry
+	 * that is still in flight */
 	list_for_each_entry_safe(entry, entry_tmp, &rb->memqueue, free_list) {
-		/*NOTE: this assumes that the free list is sorted by
-		 * timestamp, but I'm not yet sure that it is a valid
-		 * assumption
-		 */
 		if (!timestamp_cmp(ts_processed, entry->free_timestamp))
 			break;
 		KGSL_MEM_DBG("ts_processed %d ts_free %d gpuaddr %x)\n",
@@ -87,6 +85,43 @@ void kgsl_cmdstream_memqueue_drain(struct kgsl_device *device)
 	}
 }
 
+/* ask for an interrupt when the oldest queued free retires */
+static void kgsl_cmdstream_memqueue_arm(struct kgsl_device *device)
+{
+	struct kgsl_ringbuffer *rb = &device->ringbuffer;
+	struct kgsl_mem_entry *entry;
+
+	if (device->ftbl.device_timestamp_irq == NULL ||
+	    list_empty(&rb->memqueue))
+		return;
+
+	entry = list_first_entry(&rb->memqueue, struct kgsl_mem_entry,
+				 free_list);
+	if (timestamp_cmp(device->ftbl.device_cmdstream_readtimestamp(device,
+						KGSL_TIMESTAMP_RETIRED),
+			  entry->free_timestamp))
+		return;
+
+	device->ftbl.device_timestamp_irq(device, entry->free_timestamp);
+}
+
+/* scheduled from the timestamp interrupt */
+void kgsl_cmdstream_memqueue_work(struct work_struct *work)
+{
+	struct kgsl_device *device = container_of(work, struct kgsl_device,
+							memqueue_ws);
+
+	mutex_lock(&kgsl_driver.mutex);
+	if (device->flags & KGSL_FLAGS_INITIALIZED) {
+		kgsl_cmdstream_memqueue_drain(device);
+		/* a sleeping core has nothing in flight to wait for, the
+		 * next ioctl drains whatever is left */
+		if (device->hwaccess_blocked == KGSL_FALSE)
+			kgsl_cmdstream_memqueue_arm(device);
+	}
+	mutex_unlock(&kgsl_driver.mutex);
+}
+
 int
 kgsl_cmdstream_freememontimestamp(struct kgsl_device *device,
 				  struct kgsl_mem_entry *entry,
@@ -94,11 +129,21 @@ kgsl_cmdstream_freememontimestamp(struct kgsl_device *device,
 				  enum kgsl_timestamp_type type)
 {
 	struct kgsl_ringbuffer *rb = &device->ringbuffer;
+	struct kgsl_mem_entry *pos;
+
 	KGSL_MEM_DBG("enter (dev %p gpuaddr %x ts %d)\n",
 		     device, entry->memdesc.gpuaddr, timestamp);
 
-	list_add_tail(&entry->free_list, &rb->memqueue);
 	entry->free_timestamp = timestamp;
 
+	/* keep the queue sorted by timestamp.  Frees nearly always come
+	 * in submission order, so the search from the tail stops at once */
+	list_for_each_entry_reverse(pos, &rb->memqueue, free_list)
+		if (timestamp_cmp(timestamp, pos->free_timestamp))
+			break;
+	list_add(&entry->free_list, &pos->free_list);
+
+	kgsl_cmdstream_memqueue_arm(device);
+
 	return 0;
 }
@@ -61,6 +61,8 @@ int kgsl_cmdstream_close(struct kgsl_device *device);
 
 void kgsl_cmdstream_memqueue_drain(struct kgsl_device *device);
 
+void kgsl_cmdstream_memqueue_work(struct work_struct *work);
+
 uint32_t
 kgsl_cmdstream_readtimestamp(struct kgsl_device *device,
 			     enum kgsl_timestamp_type type);
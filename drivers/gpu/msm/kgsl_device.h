@@ -33,6 +33,7 @@
 #include <linux/irqreturn.h>
 #include <linux/wait.h>
 #include <linux/workqueue.h>
+#include <linux/mutex.h>
 #include <linux/msm_kgsl.h>
 
 #include <asm/atomic.h>
@@ -109,6 +110,10 @@ struct kgsl_functable {
 	unsigned int (*device_cmdstream_readtimestamp) (
 					struct kgsl_device *device,
 					enum kgsl_timestamp_type type);
+	/* raise an interrupt once timestamp retires, NULL if the core
+	 * already interrupts on every retirement */
+	int (*device_timestamp_irq) (struct kgsl_device *device,
+					unsigned int timestamp);
 	int (*device_issueibcmds) (struct kgsl_device_private *dev_priv,
 				int drawctxt_index,
 				uint32_t ibaddr, int sizedwords,
@@ -145,12 +150,23 @@ struct kgsl_device {
 	struct completion hwaccess_gate;
 	struct kgsl_functable ftbl;
 	struct work_struct idle_check_ws;
+	/* retires the memqueue from the timestamp interrupt */
+	struct work_struct memqueue_ws;
 	struct timer_list idle_timer;
 	atomic_t open_count;
 
 	struct atomic_notifier_head ts_notifier_list;
 };
 
+/* per process graphics memory usage, shown in debugfs kgsl/memstat */
+struct kgsl_process_stats {
+	unsigned int vmalloc_count;
+	unsigned long vmalloc_max;
+	unsigned int vmalloc_reused;
+	unsigned int pmem_count;
+	unsigned long pmem_size;
+};
+
 struct kgsl_file_private {
 	unsigned int refcnt;
 	struct list_head mem_list;
@@ -158,6 +174,10 @@ struct kgsl_file_private {
 	unsigned long vmalloc_size;
 	struct list_head preserve_entry_list;
 	int preserve_list_size;
+	struct kgsl_process_stats stats;
+	/* taken with kgsl_driver.mutex to change mem_list or
+	 * preserve_entry_list, either lock is enough to walk them */
+	struct mutex mem_lock;
 };
 
 struct kgsl_device_private {
@@ -175,6 +175,9 @@ irqreturn_t kgsl_g12_isr(int irq, void *data)
 			atomic_notifier_call_chain(
 				&(device->ts_notifier_list),
 				KGSL_DEVICE_G12, NULL);
+
+			if (!list_empty(&device->ringbuffer.memqueue))
+				schedule_work(&device->memqueue_ws);
 		}
 	}
 
@@ -16,6 +16,7 @@
  *
  */
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "kgsl_log.h"
 #include "kgsl_device.h"
 #include "kgsl.h"
@@ -112,6 +113,60 @@ DEFINE_SIMPLE_ATTRIBUTE(kgsl_cache_enable_fops, kgsl_cache_enable_get,
 			kgsl_cache_enable_set, "%llu\n");
 #endif /*CONFIG_MSM_KGSL_MMU*/
 
+static int kgsl_memstat_show(struct seq_file *s, void *unused)
+{
+	struct kgsl_sharedmem *shmem = &kgsl_driver.shmem;
+	struct kgsl_device_private *dev_priv, *first;
+	struct kgsl_file_private *private;
+	int i;
+
+	seq_printf(s, "%8s %6s %8s\n", "suballoc", "pages", "objects");
+	mutex_lock(&shmem->suballoc_mutex);
+	for (i = 0; i < KGSL_SUBALLOC_CLASSES; i++)
+		seq_printf(s, "%8d %6d %8d\n",
+			   1 << (i + KGSL_SUBALLOC_MIN_SHIFT),
+			   shmem->suballoc[i].num_pages,
+			   shmem->suballoc[i].num_objs);
+	mutex_unlock(&shmem->suballoc_mutex);
+
+	seq_printf(s, "\n%6s %10s %6s %10s %6s %10s %6s\n", "pid",
+		   "vmalloc", "count", "max", "reused", "pmem", "count");
+	mutex_lock(&kgsl_driver.mutex);
+	list_for_each_entry(dev_priv, &kgsl_driver.dev_priv_list, list) {
+		private = dev_priv->process_priv;
+
+		/* a process with both cores open shares one private */
+		list_for_each_entry(first, &kgsl_driver.dev_priv_list, list)
+			if (first->process_priv == private)
+				break;
+		if (first != dev_priv)
+			continue;
+
+		seq_printf(s, "%6lu %10lu %6u %10lu %6u %10lu %6u\n",
+			   dev_priv->pid, private->vmalloc_size,
+			   private->stats.vmalloc_count,
+			   private->stats.vmalloc_max,
+			   private->stats.vmalloc_reused,
+			   private->stats.pmem_size,
+			   private->stats.pmem_count);
+	}
+	mutex_unlock(&kgsl_driver.mutex);
+
+	return 0;
+}
+
+static int kgsl_memstat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kgsl_memstat_show, NULL);
+}
+
+static const struct file_operations kgsl_memstat_fops = {
+	.open = kgsl_memstat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 #endif /* CONFIG_DEBUG_FS */
 
 int kgsl_debug_init(void)
@@ -130,6 +185,8 @@ int kgsl_debug_init(void)
 				&kgsl_drv_log_fops);
 	debugfs_create_file("log_level_mem", 0644, dent, 0,
 				&kgsl_mem_log_fops);
+	debugfs_create_file("memstat", 0444, dent, 0,
+				&kgsl_memstat_fops);
 
 #ifdef CONFIG_MSM_KGSL_MMU
     debugfs_create_file("cache_enable", 0644, dent, 0,
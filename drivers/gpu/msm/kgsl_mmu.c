@@ -453,7 +453,8 @@ int kgsl_mmu_init(struct kgsl_device *device)
 		/* allocate memory used for completing r/w operations that
 		 * cannot be mapped by the MMU
 		 */
-		flags = (KGSL_MEMFLAGS_ALIGN4K | KGSL_MEMFLAGS_CONPHYS
+		flags = (KGSL_MEMFLAGS_ALIGN64 | KGSL_MEMFLAGS_CONPHYS
+			 | KGSL_MEMFLAGS_SUBALLOC
 			 | KGSL_MEMFLAGS_STRICTREQUEST);
 		status = kgsl_sharedmem_alloc(flags, 64, &mmu->dummyspace);
 		if (status != 0) {
@@ -543,6 +544,62 @@ unsigned int kgsl_virtaddr_to_physaddr(unsigned int virtaddr)
 	return physaddr;
 }
 
+/*
+* Fill ptes [pte, ptelast) for one memory type.  Each returns the first
+* pte it could not resolve, ptelast when the whole range was mapped.
+*/
+static unsigned int
+kgsl_pt_map_range_conphys(struct kgsl_pagetable *pagetable, unsigned int pte,
+			  unsigned int ptelast, unsigned int physaddr,
+			  unsigned int protflags)
+{
+	uint32_t *baseptr = (uint32_t *)pagetable->base.hostptr;
+
+	if (physaddr == 0)
+		return pte;
+
+	for (; pte < ptelast; pte++, physaddr += KGSL_PAGESIZE)
+		baseptr[pte] = physaddr | protflags;
+
+	return pte;
+}
+
+static unsigned int
+kgsl_pt_map_range_vmalloc(struct kgsl_pagetable *pagetable, unsigned int pte,
+			  unsigned int ptelast, unsigned int address,
+			  unsigned int protflags)
+{
+	uint32_t *baseptr = (uint32_t *)pagetable->base.hostptr;
+	struct page *page;
+
+	for (; pte < ptelast; pte++, address += KGSL_PAGESIZE) {
+		page = vmalloc_to_page((void *)address);
+		if (page == NULL)
+			break;
+		baseptr[pte] = (page_to_pfn(page) << PAGE_SHIFT) | protflags;
+	}
+
+	return pte;
+}
+
+static unsigned int
+kgsl_pt_map_range_hostaddr(struct kgsl_pagetable *pagetable, unsigned int pte,
+			   unsigned int ptelast, unsigned int address,
+			   unsigned int protflags)
+{
+	uint32_t *baseptr = (uint32_t *)pagetable->base.hostptr;
+	unsigned int physaddr;
+
+	for (; pte < ptelast; pte++, address += KGSL_PAGESIZE) {
+		physaddr = kgsl_virtaddr_to_physaddr(address);
+		if (physaddr == 0)
+			break;
+		baseptr[pte] = physaddr | protflags;
+	}
+
+	return pte;
+}
+
 int
 kgsl_mmu_map(struct kgsl_pagetable *pagetable,
 				unsigned int address,
@@ -612,36 +669,41 @@ kgsl_mmu_map(struct kgsl_pagetable *pagetable,
 		((ptelast + 1) & (GSL_PT_SUPER_PTE-1)) != 0)
 		flushtlb = 1;
 
-	for (pte = ptefirst; pte < ptelast; pte++) {
+	/* a dirty superpte inside the range needs a flush as well, one
+	 * check per superpte is enough */
+	for (pte = ALIGN(ptefirst, GSL_PT_SUPER_PTE);
+	     !flushtlb && pte < ptelast; pte += GSL_PT_SUPER_PTE)
+		if (GSL_TLBFLUSH_FILTER_ISDIRTY(pte / GSL_PT_SUPER_PTE))
+			flushtlb = 1;
+
 #ifdef VERBOSE_DEBUG
+	for (pte = ptefirst; pte < ptelast; pte++) {
 		/* check if PTE exists */
 		uint32_t val = kgsl_pt_map_getaddr(pagetable, pte);
 		BUG_ON(val != 0 && val != GSL_PT_PAGE_DIRTY);
+	}
 #endif
-		if ((pte & (GSL_PT_SUPER_PTE-1)) == 0)
-			if (GSL_TLBFLUSH_FILTER_ISDIRTY(pte / GSL_PT_SUPER_PTE))
-				flushtlb = 1;
-		/* mark pte as in use */
-		if (flags & KGSL_MEMFLAGS_CONPHYS)
-			physaddr = address;
-		else if (flags & KGSL_MEMFLAGS_VMALLOC_MEM) {
-			physaddr = vmalloc_to_pfn((void *)address);
-			physaddr <<= PAGE_SHIFT;
-		} else if (flags & KGSL_MEMFLAGS_HOSTADDR)
-			physaddr = kgsl_virtaddr_to_physaddr(address);
-		else
-			physaddr = 0;
-
-		if (physaddr) {
-			kgsl_pt_map_set(pagetable, pte, physaddr | protflags);
-		} else {
-			KGSL_MEM_ERR
-			("Unable to find physaddr for address: %x\n",
-			     address);
-			kgsl_mmu_unmap(pagetable, *gpuaddr, range);
-			return -EFAULT;
-		}
-		address += KGSL_PAGESIZE;
+
+	/* mark ptes as in use, the memory type is resolved once for the
+	 * whole range rather than for every page */
+	if (flags & KGSL_MEMFLAGS_CONPHYS)
+		pte = kgsl_pt_map_range_conphys(pagetable, ptefirst, ptelast,
+						address, protflags);
+	else if (flags & KGSL_MEMFLAGS_VMALLOC_MEM)
+		pte = kgsl_pt_map_range_vmalloc(pagetable, ptefirst, ptelast,
+						address, protflags);
+	else if (flags & KGSL_MEMFLAGS_HOSTADDR)
+		pte = kgsl_pt_map_range_hostaddr(pagetable, ptefirst, ptelast,
+						 address, protflags);
+	else
+		pte = ptefirst;
+
+	if (pte != ptelast) {
+		physaddr = address + ((pte - ptefirst) << KGSL_PAGESIZE_SHIFT);
+		KGSL_MEM_ERR("Unable to find physaddr for address: %x\n",
+			     physaddr);
+		kgsl_mmu_unmap(pagetable, *gpuaddr, range);
+		return -EFAULT;
 	}
 
 	KGSL_MEM_INFO("pt %p p %08x g %08x pte f %d l %d n %d f %d\n",
@@ -154,6 +154,8 @@ void kgsl_cp_intrcallback(struct kgsl_device *device)
 		atomic_notifier_call_chain(&(device->ts_notifier_list),
 					   KGSL_DEVICE_YAMATO,
 					   NULL);
+		if (!list_empty(&rb->memqueue))
+			schedule_work(&device->memqueue_ws);
 	}
 
 	KGSL_CMD_VDBG("return\n");
@@ -554,9 +556,10 @@ int kgsl_ringbuffer_init(struct kgsl_device *device)
 	}
 
 	/* allocate memory for polling and timestamps */
-	/* This really can be at 4 byte alignment boundry but for using MMU
-	 * we need to make it at page boundary */
-	flags = (KGSL_MEMFLAGS_ALIGNPAGE | KGSL_MEMFLAGS_CONPHYS);
+	/* This really can be at 4 byte alignment boundry, so share a page
+	 * with other small objects; kgsl_yamato_setup_pt maps the page */
+	flags = (KGSL_MEMFLAGS_ALIGN32 | KGSL_MEMFLAGS_CONPHYS |
+		 KGSL_MEMFLAGS_SUBALLOC);
 
 	status = kgsl_sharedmem_alloc(flags, sizeof(struct kgsl_rbmemptrs),
 					&rb->memptrs_desc);
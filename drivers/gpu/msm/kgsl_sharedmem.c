@@ -18,6 +18,9 @@
 #include <linux/io.h>
 #include <linux/spinlock.h>
 #include <linux/genalloc.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
 
 #include "kgsl_sharedmem.h"
 #include "kgsl_device.h"
@@ -45,10 +48,26 @@ kgsl_memarena_align(unsigned int address, unsigned int shift)
 	return alignedbaseaddr;
 }
 
+/* one arena page carved into equally sized objects */
+struct kgsl_suballoc_page {
+	struct list_head list;
+	unsigned int physaddr;
+	unsigned int inuse;
+	DECLARE_BITMAP(map, KGSL_PAGESIZE >> KGSL_SUBALLOC_MIN_SHIFT);
+};
+
 int
 kgsl_sharedmem_init(struct kgsl_sharedmem *shmem)
 {
 	int result = -EINVAL;
+	int i;
+
+	mutex_init(&shmem->suballoc_mutex);
+	for (i = 0; i < KGSL_SUBALLOC_CLASSES; i++) {
+		INIT_LIST_HEAD(&shmem->suballoc[i].pages);
+		shmem->suballoc[i].num_pages = 0;
+		shmem->suballoc[i].num_objs = 0;
+	}
 
 	shmem->baseptr = ioremap(shmem->physbase, shmem->size);
 	KGSL_MEM_INFO("ioremap(shm) = %p\n", shmem->baseptr);
@@ -89,6 +108,25 @@ error:
 int
 kgsl_sharedmem_close(struct kgsl_sharedmem *shmem)
 {
+	struct kgsl_suballoc_page *page, *tmp;
+	int i;
+
+	for (i = 0; i < KGSL_SUBALLOC_CLASSES; i++) {
+		list_for_each_entry_safe(page, tmp, &shmem->suballoc[i].pages,
+					 list) {
+			KGSL_MEM_ERR("leaked %d objects of size %d at %08x\n",
+				     page->inuse,
+				     1 << (i + KGSL_SUBALLOC_MIN_SHIFT),
+				     page->physaddr);
+			list_del(&page->list);
+			gen_pool_free(shmem->pool, page->physaddr,
+				      KGSL_PAGESIZE);
+			kfree(page);
+		}
+		shmem->suballoc[i].num_pages = 0;
+		shmem->suballoc[i].num_objs = 0;
+	}
+
 	if (shmem->pool) {
 		gen_pool_destroy(shmem->pool);
 		shmem->pool = NULL;
@@ -134,6 +172,134 @@ static void *kgsl_memarena_gethostptr(struct kgsl_sharedmem *shmem,
 	return result;
 }
 
+/*
+* size class for a suballocated object, or -1 if the request has to
+* come straight from the arena
+*/
+static int kgsl_suballoc_get_class(unsigned int size, unsigned int alignshift)
+{
+	unsigned int shift;
+
+	if (size > (1 << KGSL_SUBALLOC_MAX_SHIFT))
+		return -1;
+
+	shift = size > 1 ? fls(size - 1) : 0;
+	shift = max(shift, alignshift);
+	shift = max(shift, (unsigned int)KGSL_SUBALLOC_MIN_SHIFT);
+	if (shift > KGSL_SUBALLOC_MAX_SHIFT)
+		return -1;
+
+	return shift - KGSL_SUBALLOC_MIN_SHIFT;
+}
+
+/*
+* hand out a free object of the given class, carving a new page out of
+* the arena when all pages of the class are full.  Objects are aligned
+* to their size.
+*/
+static int kgsl_sharedmem_suballoc(struct kgsl_sharedmem *shmem, int class,
+				   struct kgsl_memdesc *memdesc)
+{
+	struct kgsl_suballoc_class *sc = &shmem->suballoc[class];
+	struct kgsl_suballoc_page *page;
+	unsigned int shift = class + KGSL_SUBALLOC_MIN_SHIFT;
+	unsigned int nobjs = KGSL_PAGESIZE >> shift;
+	unsigned int bit;
+
+	mutex_lock(&shmem->suballoc_mutex);
+
+	/* pages with free slots are kept at the head of the list */
+	if (!list_empty(&sc->pages)) {
+		page = list_first_entry(&sc->pages, struct kgsl_suballoc_page,
+					list);
+		if (page->inuse < nobjs)
+			goto found;
+	}
+
+	page = kzalloc(sizeof(*page), GFP_KERNEL);
+	if (page == NULL) {
+		mutex_unlock(&shmem->suballoc_mutex);
+		return -ENOMEM;
+	}
+
+	page->physaddr = gen_pool_alloc(shmem->pool, KGSL_PAGESIZE);
+	if (page->physaddr == 0) {
+		KGSL_MEM_ERR("gen_pool_alloc failed\n");
+		mutex_unlock(&shmem->suballoc_mutex);
+		kfree(page);
+		return -ENOMEM;
+	}
+	list_add(&page->list, &sc->pages);
+	sc->num_pages++;
+
+found:
+	bit = find_first_zero_bit(page->map, nobjs);
+	BUG_ON(bit >= nobjs);
+	__set_bit(bit, page->map);
+	page->inuse++;
+	sc->num_objs++;
+
+	/* a full page goes to the tail so the head always has room */
+	if (page->inuse == nobjs)
+		list_move_tail(&page->list, &sc->pages);
+
+	memdesc->physaddr = page->physaddr + (bit << shift);
+
+	mutex_unlock(&shmem->suballoc_mutex);
+
+	memdesc->hostptr = kgsl_memarena_gethostptr(shmem, memdesc->physaddr);
+	memdesc->size = 1 << shift;
+	memdesc->priv = KGSL_MEMFLAGS_SUBALLOC;
+
+	KGSL_MEM_VDBG("suballoc physaddr %08x size %d page %08x inuse %d\n",
+		      memdesc->physaddr, memdesc->size, page->physaddr,
+		      page->inuse);
+	return 0;
+}
+
+static void kgsl_sharedmem_subfree(struct kgsl_sharedmem *shmem,
+				   struct kgsl_memdesc *memdesc)
+{
+	struct kgsl_suballoc_class *sc;
+	struct kgsl_suballoc_page *page;
+	unsigned int shift = ilog2(memdesc->size);
+	unsigned int physbase = memdesc->physaddr & KGSL_PAGEMASK;
+	unsigned int bit;
+
+	BUG_ON(shift < KGSL_SUBALLOC_MIN_SHIFT ||
+	       shift > KGSL_SUBALLOC_MAX_SHIFT);
+	sc = &shmem->suballoc[shift - KGSL_SUBALLOC_MIN_SHIFT];
+
+	mutex_lock(&shmem->suballoc_mutex);
+
+	list_for_each_entry(page, &sc->pages, list)
+		if (page->physaddr == physbase)
+			goto found;
+
+	mutex_unlock(&shmem->suballoc_mutex);
+	KGSL_MEM_ERR("no suballoc page for physaddr %08x size %d\n",
+		     memdesc->physaddr, memdesc->size);
+	BUG();
+	return;
+
+found:
+	bit = (memdesc->physaddr - physbase) >> shift;
+	BUG_ON(!test_bit(bit, page->map));
+	__clear_bit(bit, page->map);
+	page->inuse--;
+	sc->num_objs--;
+
+	if (page->inuse == 0) {
+		list_del(&page->list);
+		sc->num_pages--;
+		gen_pool_free(shmem->pool, page->physaddr, KGSL_PAGESIZE);
+		kfree(page);
+	} else {
+		list_move(&page->list, &sc->pages);
+	}
+
+	mutex_unlock(&shmem->suballoc_mutex);
+}
 
 int
 kgsl_sharedmem_alloc(uint32_t flags, int size,
@@ -145,6 +311,7 @@ kgsl_sharedmem_alloc(uint32_t flags, int size,
 	unsigned int baseaddr;
 	unsigned int alignshift;
 	unsigned int alignedbaseaddr;
+	int class;
 
 	KGSL_MEM_VDBG("enter (flags=0x%08x, size=%d, memdesc=%p)\n",
 					flags, size, memdesc);
@@ -155,6 +322,16 @@ kgsl_sharedmem_alloc(uint32_t flags, int size,
 
 	alignshift = kgsl_memarena_get_order(flags);
 
+	/* small objects share arena pages instead of taking one each */
+	if (flags & KGSL_MEMFLAGS_SUBALLOC) {
+		class = kgsl_suballoc_get_class(size, alignshift);
+		if (class >= 0) {
+			result = kgsl_sharedmem_suballoc(shmem, class,
+							 memdesc);
+			goto done;
+		}
+	}
+
 	size = ALIGN(size, KGSL_PAGESIZE);
 	blksize = size;
 	if (alignshift > KGSL_PAGESIZE_SHIFT)
@@ -226,7 +403,10 @@ kgsl_sharedmem_free(struct kgsl_memdesc *memdesc)
 	BUG_ON((shmem->physbase + shmem->size)
 	       < (memdesc->physaddr + memdesc->size));
 
-	gen_pool_free(shmem->pool, memdesc->physaddr, memdesc->size);
+	if (memdesc->priv & KGSL_MEMFLAGS_SUBALLOC)
+		kgsl_sharedmem_subfree(shmem, memdesc);
+	else
+		gen_pool_free(shmem->pool, memdesc->physaddr, memdesc->size);
 
 	memset(memdesc, 0, sizeof(struct kgsl_memdesc));
 	KGSL_MEM_VDBG("return\n");
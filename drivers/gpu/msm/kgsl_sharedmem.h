@@ -30,6 +30,8 @@
 #define __GSL_SHAREDMEM_H
 
 #include <linux/types.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/msm_kgsl.h>
 
 #define KGSL_PAGESIZE           0x1000
@@ -57,6 +59,8 @@ struct gen_pool;
 #define KGSL_MEMFLAGS_CONPHYS 	0x00001000
 #define KGSL_MEMFLAGS_VMALLOC_MEM	0x00002000
 #define KGSL_MEMFLAGS_HOSTADDR		0x00004000
+/* small object carved out of a shared page, see kgsl_sharedmem_alloc */
+#define KGSL_MEMFLAGS_SUBALLOC		0x00008000
 
 #define KGSL_MEMFLAGS_ALIGNANY	0x00000000
 #define KGSL_MEMFLAGS_ALIGN32	0x00000000
@@ -93,11 +97,27 @@ struct kgsl_memdesc {
 	unsigned int priv;
 };
 
+/* suballocation size classes: 64 bytes up to half a page */
+#define KGSL_SUBALLOC_MIN_SHIFT	6
+#define KGSL_SUBALLOC_MAX_SHIFT	(KGSL_PAGESIZE_SHIFT - 1)
+#define KGSL_SUBALLOC_CLASSES	(KGSL_SUBALLOC_MAX_SHIFT - \
+				 KGSL_SUBALLOC_MIN_SHIFT + 1)
+
+struct kgsl_suballoc_class {
+	/* pages carved into objects of this class */
+	struct list_head pages;
+	unsigned int num_pages;
+	unsigned int num_objs;
+};
+
 struct kgsl_sharedmem {
 	void *baseptr;
 	unsigned int physbase;
 	unsigned int size;
 	struct gen_pool *pool;
+
+	struct mutex suballoc_mutex;
+	struct kgsl_suballoc_class suballoc[KGSL_SUBALLOC_CLASSES];
 };
 
 int kgsl_sharedmem_alloc(uint32_t flags, int size,
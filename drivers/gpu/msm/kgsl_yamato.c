@@ -279,20 +279,48 @@ irqreturn_t kgsl_yamato_isr(int irq, void *data)
 	return result;
 }
 
+/*
+* Small shared memory objects may be suballocated and not start on a page
+* boundary, so map the pages they live in and keep the offset into the
+* first one, like kgsl_ioctl_sharedmem_from_pmem does.
+*/
+static int kgsl_yamato_map_shmem(struct kgsl_pagetable *pagetable,
+				 struct kgsl_memdesc *memdesc,
+				 unsigned int protflags,
+				 unsigned int *gpuaddr)
+{
+	unsigned int offset = memdesc->physaddr & ~KGSL_PAGEMASK;
+	int result;
+
+	result = kgsl_mmu_map(pagetable, memdesc->physaddr - offset,
+			      ALIGN(memdesc->size + offset, KGSL_PAGESIZE),
+			      protflags, gpuaddr,
+			      KGSL_MEMFLAGS_CONPHYS | KGSL_MEMFLAGS_ALIGN4K);
+	if (result == 0)
+		*gpuaddr += offset;
+
+	return result;
+}
+
+static void kgsl_yamato_unmap_shmem(struct kgsl_pagetable *pagetable,
+				    struct kgsl_memdesc *memdesc)
+{
+	unsigned int offset = memdesc->gpuaddr & ~KGSL_PAGEMASK;
+
+	kgsl_mmu_unmap(pagetable, memdesc->gpuaddr - offset,
+		       ALIGN(memdesc->size + offset, KGSL_PAGESIZE));
+}
+
 int kgsl_yamato_cleanup_pt(struct kgsl_device *device,
 			struct kgsl_pagetable *pagetable)
 {
-	kgsl_mmu_unmap(pagetable, device->ringbuffer.buffer_desc.gpuaddr,
-			device->ringbuffer.buffer_desc.size);
+	kgsl_yamato_unmap_shmem(pagetable, &device->ringbuffer.buffer_desc);
 
-	kgsl_mmu_unmap(pagetable, device->ringbuffer.memptrs_desc.gpuaddr,
-			device->ringbuffer.memptrs_desc.size);
+	kgsl_yamato_unmap_shmem(pagetable, &device->ringbuffer.memptrs_desc);
 
-	kgsl_mmu_unmap(pagetable, device->memstore.gpuaddr,
-			device->memstore.size);
+	kgsl_yamato_unmap_shmem(pagetable, &device->memstore);
 
-	kgsl_mmu_unmap(pagetable, device->mmu.dummyspace.gpuaddr,
-			device->mmu.dummyspace.size);
+	kgsl_yamato_unmap_shmem(pagetable, &device->mmu.dummyspace);
 
 	return 0;
 }
@@ -310,11 +338,9 @@ int kgsl_yamato_setup_pt(struct kgsl_device *device,
 	BUG_ON(device->mmu.dummyspace.physaddr == 0);
 #endif
 
-	result = kgsl_mmu_map(pagetable,
-				device->ringbuffer.buffer_desc.physaddr,
-				device->ringbuffer.buffer_desc.size,
-				GSL_PT_PAGE_RV, &gpuaddr,
-				KGSL_MEMFLAGS_CONPHYS | KGSL_MEMFLAGS_ALIGN4K);
+	result = kgsl_yamato_map_shmem(pagetable,
+				&device->ringbuffer.buffer_desc,
+				GSL_PT_PAGE_RV, &gpuaddr);
 
 	if (result)
 		goto error;
@@ -323,11 +349,9 @@ int kgsl_yamato_setup_pt(struct kgsl_device *device,
 		device->ringbuffer.buffer_desc.gpuaddr = gpuaddr;
 	BUG_ON(device->ringbuffer.buffer_desc.gpuaddr != gpuaddr);
 
-	result = kgsl_mmu_map(pagetable,
-				device->ringbuffer.memptrs_desc.physaddr,
-				device->ringbuffer.memptrs_desc.size,
-				GSL_PT_PAGE_RV | GSL_PT_PAGE_WV, &gpuaddr,
-				KGSL_MEMFLAGS_CONPHYS | KGSL_MEMFLAGS_ALIGN4K);
+	result = kgsl_yamato_map_shmem(pagetable,
+				&device->ringbuffer.memptrs_desc,
+				GSL_PT_PAGE_RV | GSL_PT_PAGE_WV, &gpuaddr);
 	if (result)
 		goto unmap_buffer_desc;
 
@@ -335,10 +359,8 @@ int kgsl_yamato_setup_pt(struct kgsl_device *device,
 		device->ringbuffer.memptrs_desc.gpuaddr = gpuaddr;
 	BUG_ON(device->ringbuffer.memptrs_desc.gpuaddr != gpuaddr);
 
-	result = kgsl_mmu_map(pagetable, device->memstore.physaddr,
-				device->memstore.size,
-				GSL_PT_PAGE_RV | GSL_PT_PAGE_WV, &gpuaddr,
-				KGSL_MEMFLAGS_CONPHYS | KGSL_MEMFLAGS_ALIGN4K);
+	result = kgsl_yamato_map_shmem(pagetable, &device->memstore,
+				GSL_PT_PAGE_RV | GSL_PT_PAGE_WV, &gpuaddr);
 	if (result)
 		goto unmap_memptrs_desc;
 
@@ -346,11 +368,8 @@ int kgsl_yamato_setup_pt(struct kgsl_device *device,
 		device->memstore.gpuaddr = gpuaddr;
 	BUG_ON(device->memstore.gpuaddr != gpuaddr);
 
-	result = kgsl_mmu_map(pagetable,
-			device->mmu.dummyspace.physaddr,
-			device->mmu.dummyspace.size,
-			GSL_PT_PAGE_RV | GSL_PT_PAGE_WV, &gpuaddr,
-			KGSL_MEMFLAGS_CONPHYS | KGSL_MEMFLAGS_ALIGN4K);
+	result = kgsl_yamato_map_shmem(pagetable, &device->mmu.dummyspace,
+			GSL_PT_PAGE_RV | GSL_PT_PAGE_WV, &gpuaddr);
 
 	if (result)
 		goto unmap_memstore_desc;
@@ -362,15 +381,12 @@ int kgsl_yamato_setup_pt(struct kgsl_device *device,
 	return result;
 
 unmap_memstore_desc:
-	kgsl_mmu_unmap(pagetable, device->memstore.gpuaddr,
-			device->memstore.size);
+	kgsl_yamato_unmap_shmem(pagetable, &device->memstore);
 
 unmap_memptrs_desc:
-	kgsl_mmu_unmap(pagetable, device->ringbuffer.memptrs_desc.gpuaddr,
-			device->ringbuffer.memptrs_desc.size);
+	kgsl_yamato_unmap_shmem(pagetable, &device->ringbuffer.memptrs_desc);
 unmap_buffer_desc:
-	kgsl_mmu_unmap(pagetable, device->ringbuffer.buffer_desc.gpuaddr,
-			device->ringbuffer.buffer_desc.size);
+	kgsl_yamato_unmap_shmem(pagetable, &device->ringbuffer.buffer_desc);
 error:
 	return result;
 
@@ -1097,46 +1113,59 @@ int kgsl_yamato_regwrite(struct kgsl_device *device, unsigned int offsetwords,
 	return 0;
 }
 
-static int kgsl_check_interrupt_timestamp(struct kgsl_device *device,
+/* MUST be called with the kgsl_driver.mutex held */
+static int kgsl_yamato_timestamp_irq(struct kgsl_device *device,
 					unsigned int timestamp)
 {
-	int status;
 	unsigned int ref_ts, enableflag;
 
-	status = kgsl_cmdstream_check_timestamp(device, timestamp);
-	if (!status) {
-		mutex_lock(&kgsl_driver.mutex);
-		kgsl_sharedmem_readl(&device->memstore, &enableflag,
-			KGSL_DEVICE_MEMSTORE_OFFSET(ts_cmp_enable));
-		rmb();
+	if (!(device->ringbuffer.flags & KGSL_FLAGS_STARTED))
+		return -EINVAL;
 
-		if (enableflag) {
-			kgsl_sharedmem_readl(&device->memstore, &ref_ts,
-				KGSL_DEVICE_MEMSTORE_OFFSET(ref_wait_ts));
-			rmb();
-			if (timestamp_cmp(ref_ts, timestamp)) {
-				kgsl_sharedmem_writel(&device->memstore,
-				KGSL_DEVICE_MEMSTORE_OFFSET(ref_wait_ts),
-				timestamp);
-				wmb();
-			}
-		} else {
-			unsigned int cmds[2];
-			kgsl_sharedmem_writel(&device->memstore,
-				KGSL_DEVICE_MEMSTORE_OFFSET(ref_wait_ts),
-				timestamp);
-			enableflag = 1;
+	kgsl_sharedmem_readl(&device->memstore, &enableflag,
+		KGSL_DEVICE_MEMSTORE_OFFSET(ts_cmp_enable));
+	rmb();
+
+	if (enableflag) {
+		kgsl_sharedmem_readl(&device->memstore, &ref_ts,
+			KGSL_DEVICE_MEMSTORE_OFFSET(ref_wait_ts));
+		rmb();
+		if (timestamp_cmp(ref_ts, timestamp)) {
 			kgsl_sharedmem_writel(&device->memstore,
-				KGSL_DEVICE_MEMSTORE_OFFSET(ts_cmp_enable),
-				enableflag);
+			KGSL_DEVICE_MEMSTORE_OFFSET(ref_wait_ts),
+			timestamp);
 			wmb();
-			/* submit a dummy packet so that even if all
-			* commands upto timestamp get executed we will still
-			* get an interrupt */
-			cmds[0] = pm4_type3_packet(PM4_NOP, 1);
-			cmds[1] = 0;
-			kgsl_ringbuffer_issuecmds(device, 0, &cmds[0], 2);
 		}
+	} else {
+		unsigned int cmds[2];
+		kgsl_sharedmem_writel(&device->memstore,
+			KGSL_DEVICE_MEMSTORE_OFFSET(ref_wait_ts),
+			timestamp);
+		enableflag = 1;
+		kgsl_sharedmem_writel(&device->memstore,
+			KGSL_DEVICE_MEMSTORE_OFFSET(ts_cmp_enable),
+			enableflag);
+		wmb();
+		/* submit a dummy packet so that even if all
+		* commands upto timestamp get executed we will still
+		* get an interrupt */
+		cmds[0] = pm4_type3_packet(PM4_NOP, 1);
+		cmds[1] = 0;
+		kgsl_ringbuffer_issuecmds(device, 0, &cmds[0], 2);
+	}
+
+	return 0;
+}
+
+static int kgsl_check_interrupt_timestamp(struct kgsl_device *device,
+					unsigned int timestamp)
+{
+	int status;
+
+	status = kgsl_cmdstream_check_timestamp(device, timestamp);
+	if (!status) {
+		mutex_lock(&kgsl_driver.mutex);
+		kgsl_yamato_timestamp_irq(device, timestamp);
 		mutex_unlock(&kgsl_driver.mutex);
 	}
 
@@ -1304,6 +1333,7 @@ int kgsl_yamato_getfunctable(struct kgsl_functable *ftbl)
 	ftbl->device_getproperty = kgsl_yamato_getproperty;
 	ftbl->device_waittimestamp = kgsl_yamato_waittimestamp;
 	ftbl->device_cmdstream_readtimestamp = kgsl_cmdstream_readtimestamp;
+	ftbl->device_timestamp_irq = kgsl_yamato_timestamp_irq;
 	ftbl->device_issueibcmds = kgsl_ringbuffer_issueibcmds;
 	ftbl->device_drawctxt_create = kgsl_drawctxt_create;
 	ftbl->device_drawctxt_destroy = kgsl_drawctxt_destroy;
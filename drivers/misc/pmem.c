@@ -24,6 +24,7 @@
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/kobject.h>
+#include <linux/rbtree.h>
 #ifdef CONFIG_MEMORY_HOTPLUG
 #include <linux/memory.h>
 #include <linux/memory_hotplug.h>
@@ -68,6 +69,9 @@
 #define PMEM_FLAGS_SUBMAP 0x1 << 3
 #define PMEM_FLAGS_UNSUBMAP 0x1 << 4
 
+/* cache flushes a file can have queued before they are done right away */
+#define PMEM_MAX_PENDING_FLUSHES 4
+
 struct pmem_data {
 	/* in alloc mode: an index into the bitmap
 	 * in no_alloc mode: the size of the allocation */
@@ -92,6 +96,14 @@ struct pmem_data {
 	struct list_head region_list;
 	/* a linked list of data so we can access them for debugging */
 	struct list_head list;
+	/* cache flushes queued by pmem_queue_flush, as offsets into the
+	 * allocation, overlapping and adjacent ranges are merged */
+	spinlock_t flush_lock;
+	int nr_pending_flushes;
+	struct {
+		unsigned long start;
+		unsigned long end;
+	} pending_flushes[PMEM_MAX_PENDING_FLUSHES];
 #if PMEM_DEBUG
 	int ref;
 #endif
@@ -107,6 +119,15 @@ struct pmem_region_node {
 	struct list_head list;
 };
 
+struct pmem_extent {
+	/* free extents are in the by-address and the by-size trees,
+	 * allocations only in the allocated tree, through addr_node */
+	struct rb_node addr_node;
+	struct rb_node size_node;
+	unsigned long start;	/* in quanta */
+	unsigned long quanta;
+};
+
 #define PMEM_DEBUG_MSGS 0
 #if PMEM_DEBUG_MSGS
 #define DLOG(fmt,args...) \
@@ -202,6 +223,20 @@ struct pmem_info {
 				unsigned short quanta;
 			} *bitm_alloc;
 		} bitmap;
+
+		struct {
+			/* free extents sorted by start, and by size then
+			 * start for best fit; allocations sorted by start */
+			struct rb_root free_by_addr;
+			struct rb_root free_by_size;
+			struct rb_root allocated;
+			unsigned long free_quanta;
+			unsigned long free_extents;
+			unsigned long allocs;
+			unsigned long failures;
+			/* failures with enough free space in total */
+			unsigned long frag_failures;
+		} extent;
 	} allocator;
 
 	int id;
@@ -221,6 +256,12 @@ struct pmem_info {
 
 	long (*ioctl)(struct file *, unsigned int, unsigned long);
 	int (*release)(struct inode *, struct file *);
+
+	/* cache maintenance asked for and actually done, in bytes */
+	spinlock_t cache_stats_lock;
+	u64 cache_maint_requested;
+	u64 cache_maint_done;
+	u64 cache_maint_skipped;
 };
 #define to_pmem_info_id(a) (container_of(a, struct pmem_info, kobj)->id)
 
@@ -352,6 +393,8 @@ static ssize_t show_pmem_allocator_type(int id, char *buf)
 		return scnprintf(buf, PAGE_SIZE, "%s\n", "Buddy Bestfit");
 	case  PMEM_ALLOCATORTYPE_BITMAP:
 		return scnprintf(buf, PAGE_SIZE, "%s\n", "Bitmap");
+	case  PMEM_ALLOCATORTYPE_EXTENT:
+		return scnprintf(buf, PAGE_SIZE, "%s\n", "Extent Tree");
 	default:
 		return scnprintf(buf, PAGE_SIZE,
 			"??? Invalid allocator type (%d) for this region! "
@@ -395,11 +438,48 @@ static ssize_t show_pmem_mapped_regions(int id, char *buf)
 }
 RO_PMEM_ATTR(mapped_regions);
 
+static ssize_t show_pmem_fragmentation(int id, char *buf)
+{
+	struct pmem_freespace fs;
+	unsigned long total_quanta, largest_quanta;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	pmem[id].free_space(id, &fs);
+	mutex_unlock(&pmem[id].arena_mutex);
+
+	/* in quanta so the percentage can't overflow */
+	total_quanta = fs.total / pmem[id].quantum;
+	largest_quanta = fs.largest / pmem[id].quantum;
+	return scnprintf(buf, PAGE_SIZE,
+		"free %lu largest %lu fragmentation %lu%%\n",
+		fs.total, fs.largest, total_quanta ?
+		100 - largest_quanta * 100 / total_quanta : 0);
+}
+RO_PMEM_ATTR(fragmentation);
+
+static ssize_t show_pmem_cache_maint(int id, char *buf)
+{
+	u64 requested, done, skipped;
+
+	spin_lock(&pmem[id].cache_stats_lock);
+	requested = pmem[id].cache_maint_requested;
+	done = pmem[id].cache_maint_done;
+	skipped = pmem[id].cache_maint_skipped;
+	spin_unlock(&pmem[id].cache_stats_lock);
+
+	return scnprintf(buf, PAGE_SIZE,
+		"requested %llu flushed %llu skipped uncached %llu\n",
+		requested, done, skipped);
+}
+RO_PMEM_ATTR(cache_maint);
+
 #define PMEM_COMMON_SYSFS_ATTRS \
 	&pmem_attr_base.attr, \
 	&pmem_attr_size.attr, \
 	&pmem_attr_allocator_type.attr, \
-	&pmem_attr_mapped_regions.attr
+	&pmem_attr_mapped_regions.attr, \
+	&pmem_attr_fragmentation.attr, \
+	&pmem_attr_cache_maint.attr
 
 
 static ssize_t show_pmem_allocated(int id, char *buf)
@@ -484,8 +564,12 @@ static ssize_t show_pmem_free_quanta(int id, char *buf)
 	ssize_t ret;
 
 	mutex_lock(&pmem[id].arena_mutex);
-	ret = scnprintf(buf, PAGE_SIZE, "%u\n",
-		pmem[id].allocator.bitmap.bitmap_free);
+	if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_EXTENT)
+		ret = scnprintf(buf, PAGE_SIZE, "%lu\n",
+			pmem[id].allocator.extent.free_quanta);
+	else
+		ret = scnprintf(buf, PAGE_SIZE, "%u\n",
+			pmem[id].allocator.bitmap.bitmap_free);
 	mutex_unlock(&pmem[id].arena_mutex);
 	return ret;
 }
@@ -531,6 +615,39 @@ static struct kobj_type pmem_bitmap_ktype = {
 	.default_attrs = pmem_bitmap_attrs,
 };
 
+static ssize_t show_pmem_extent_stats(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE,
+		"free extents\tallocations\tfailures\tfragmented failures\n"
+		"%lu\t%lu\t%lu\t%lu\n",
+		pmem[id].allocator.extent.free_extents,
+		pmem[id].allocator.extent.allocs,
+		pmem[id].allocator.extent.failures,
+		pmem[id].allocator.extent.frag_failures);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(extent_stats);
+
+static struct attribute *pmem_extent_attrs[] = {
+	PMEM_COMMON_SYSFS_ATTRS,
+
+	PMEM_BITMAP_BUDDY_BESTFIT_COMMON_SYSFS_ATTRS,
+
+	&pmem_attr_free_quanta.attr,
+	&pmem_attr_extent_stats.attr,
+
+	NULL
+};
+
+static struct kobj_type pmem_extent_ktype = {
+	.sysfs_ops = &pmem_ops,
+	.default_attrs = pmem_extent_attrs,
+};
+
 static int get_id(struct file *file)
 {
 	return MINOR(file->f_dentry->d_inode->i_rdev);
@@ -877,6 +994,8 @@ static int pmem_open(struct inode *inode, struct file *file)
 	data->vma = NULL;
 	data->pid = 0;
 	data->master_file = NULL;
+	spin_lock_init(&data->flush_lock);
+	data->nr_pending_flushes = 0;
 #if PMEM_DEBUG
 	data->ref = 0;
 #endif
@@ -1218,6 +1337,258 @@ leave:
 	return bitnum;
 }
 
+/* The extent allocator keeps the free space as extents in two rbtrees, one
+ * sorted by address to merge neighbours on free and one sorted by size to
+ * find the best fit in O(log n). Among extents of the same size the lowest
+ * address wins, which keeps allocations packed towards the start.
+ */
+static void extent_insert_addr(struct rb_root *root, struct pmem_extent *e)
+{
+	struct rb_node **p = &root->rb_node, *parent = NULL;
+
+	while (*p) {
+		struct pmem_extent *curr =
+			rb_entry(*p, struct pmem_extent, addr_node);
+
+		parent = *p;
+		if (e->start < curr->start)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&e->addr_node, parent, p);
+	rb_insert_color(&e->addr_node, root);
+}
+
+static void extent_insert_size(struct rb_root *root, struct pmem_extent *e)
+{
+	struct rb_node **p = &root->rb_node, *parent = NULL;
+
+	while (*p) {
+		struct pmem_extent *curr =
+			rb_entry(*p, struct pmem_extent, size_node);
+
+		parent = *p;
+		if (e->quanta < curr->quanta ||
+		    (e->quanta == curr->quanta && e->start < curr->start))
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&e->size_node, parent, p);
+	rb_insert_color(&e->size_node, root);
+}
+
+static void extent_add_free(const int id, struct pmem_extent *e)
+{
+	extent_insert_addr(&pmem[id].allocator.extent.free_by_addr, e);
+	extent_insert_size(&pmem[id].allocator.extent.free_by_size, e);
+	pmem[id].allocator.extent.free_quanta += e->quanta;
+	pmem[id].allocator.extent.free_extents++;
+}
+
+static void extent_del_free(const int id, struct pmem_extent *e)
+{
+	rb_erase(&e->addr_node, &pmem[id].allocator.extent.free_by_addr);
+	rb_erase(&e->size_node, &pmem[id].allocator.extent.free_by_size);
+	pmem[id].allocator.extent.free_quanta -= e->quanta;
+	pmem[id].allocator.extent.free_extents--;
+}
+
+static struct pmem_extent *extent_find_alloc(const int id,
+		unsigned long start)
+{
+	struct rb_node *node = pmem[id].allocator.extent.allocated.rb_node;
+
+	while (node) {
+		struct pmem_extent *e =
+			rb_entry(node, struct pmem_extent, addr_node);
+
+		if (start < e->start)
+			node = node->rb_left;
+		else if (start > e->start)
+			node = node->rb_right;
+		else
+			return e;
+	}
+	return NULL;
+}
+
+/* smallest free extent of at least quanta, NULL if there is none */
+static struct rb_node *extent_best_fit(const int id, unsigned long quanta)
+{
+	struct rb_node *node = pmem[id].allocator.extent.free_by_size.rb_node;
+	struct rb_node *best = NULL;
+
+	while (node) {
+		struct pmem_extent *e =
+			rb_entry(node, struct pmem_extent, size_node);
+
+		if (e->quanta >= quanta) {
+			best = node;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	return best;
+}
+
+static unsigned long extent_align(const int id, unsigned long start,
+		unsigned int align)
+{
+	if (align <= pmem[id].quantum)
+		return start;
+	return bit_from_paddr(id,
+		(paddr_from_bit(id, start) + align - 1) & ~(align - 1));
+}
+
+static int pmem_allocator_extent(const int id,
+		const unsigned long len,
+		const unsigned int align)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct pmem_extent *e = NULL, *head = NULL, *alloc;
+	struct rb_node *node;
+	unsigned long quanta = (len + pmem[id].quantum - 1) / pmem[id].quantum;
+	unsigned long start = 0, end;
+
+	DLOG("extent id %d, len %ld, align %u\n", id, len, align);
+	if (!quanta || quanta > pmem[id].allocator.extent.free_quanta)
+		goto fail;
+
+	/* the best fit nearly always satisfies the alignment too, larger
+	 * extents are only looked at when it doesn't */
+	for (node = extent_best_fit(id, quanta); node; node = rb_next(node)) {
+		e = rb_entry(node, struct pmem_extent, size_node);
+		start = extent_align(id, e->start, align);
+		if (start + quanta <= e->start + e->quanta)
+			break;
+	}
+	if (!node) {
+		pmem[id].allocator.extent.frag_failures++;
+#if PMEM_DEBUG
+		printk(KERN_ALERT "pmem: %s: no free extent of %lu quanta, "
+			"%lu quanta free in %lu extents, id %d\n", __func__,
+			quanta, pmem[id].allocator.extent.free_quanta,
+			pmem[id].allocator.extent.free_extents, id);
+#endif
+		goto fail;
+	}
+
+	alloc = kmalloc(sizeof(*alloc), GFP_KERNEL);
+	if (!alloc)
+		goto fail;
+	if (start > e->start) {
+		head = kmalloc(sizeof(*head), GFP_KERNEL);
+		if (!head) {
+			kfree(alloc);
+			goto fail;
+		}
+	}
+
+	extent_del_free(id, e);
+	end = e->start + e->quanta;
+	if (head) {
+		head->start = e->start;
+		head->quanta = start - e->start;
+		extent_add_free(id, head);
+	}
+	if (start + quanta < end) {
+		e->start = start + quanta;
+		e->quanta = end - e->start;
+		extent_add_free(id, e);
+	} else {
+		kfree(e);
+	}
+
+	alloc->start = start;
+	alloc->quanta = quanta;
+	extent_insert_addr(&pmem[id].allocator.extent.allocated, alloc);
+	pmem[id].allocator.extent.allocs++;
+	return start;
+
+fail:
+	pmem[id].allocator.extent.failures++;
+	return -1;
+}
+
+static int pmem_free_extent(int id, int index)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct pmem_extent *e = extent_find_alloc(id, index);
+	struct pmem_extent *prev = NULL, *next = NULL;
+	struct rb_node *node;
+
+	DLOG("index %d\n", index);
+	if (!e) {
+		char currtask_name[FIELD_SIZEOF(struct task_struct, comm) + 1];
+
+		printk(KERN_ALERT "pmem: %s: Attempt to free unallocated "
+			"index %d, id %d, pid %d(%s)\n", __func__, index, id,
+			current->pid, get_task_comm(currtask_name, current));
+		return -1;
+	}
+	rb_erase(&e->addr_node, &pmem[id].allocator.extent.allocated);
+
+	/* find the free neighbours and merge with them */
+	node = pmem[id].allocator.extent.free_by_addr.rb_node;
+	while (node) {
+		struct pmem_extent *curr =
+			rb_entry(node, struct pmem_extent, addr_node);
+
+		if (curr->start < e->start) {
+			prev = curr;
+			node = node->rb_right;
+		} else {
+			next = curr;
+			node = node->rb_left;
+		}
+	}
+	if (prev && prev->start + prev->quanta == e->start) {
+		extent_del_free(id, prev);
+		e->start = prev->start;
+		e->quanta += prev->quanta;
+		kfree(prev);
+	}
+	if (next && e->start + e->quanta == next->start) {
+		extent_del_free(id, next);
+		e->quanta += next->quanta;
+		kfree(next);
+	}
+	extent_add_free(id, e);
+	return 0;
+}
+
+static int pmem_free_space_extent(int id, struct pmem_freespace *fs)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct rb_node *node =
+		rb_last(&pmem[id].allocator.extent.free_by_size);
+
+	fs->total = pmem[id].allocator.extent.free_quanta * pmem[id].quantum;
+	fs->largest = node ? rb_entry(node, struct pmem_extent,
+			size_node)->quanta * pmem[id].quantum : 0;
+	return 0;
+}
+
+static void pmem_extent_destroy(int id)
+{
+	struct rb_root *roots[] = {
+		&pmem[id].allocator.extent.free_by_addr,
+		&pmem[id].allocator.extent.allocated,
+	};
+	struct rb_node *node;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(roots); i++)
+		while ((node = rb_first(roots[i]))) {
+			rb_erase(node, roots[i]);
+			kfree(rb_entry(node, struct pmem_extent, addr_node));
+		}
+	pmem[id].allocator.extent.free_by_size = RB_ROOT;
+}
+
 static pgprot_t phys_mem_access_prot(struct file *file, pgprot_t vma_prot)
 {
 	int id = get_id(file);
@@ -1250,6 +1621,11 @@ static unsigned long pmem_start_addr_bitmap(int id, struct pmem_data *data)
 	return data->index * pmem[id].quantum + pmem[id].base;
 }
 
+static unsigned long pmem_start_addr_extent(int id, struct pmem_data *data)
+{
+	return paddr_from_bit(id, data->index);
+}
+
 static void *pmem_start_vaddr(int id, struct pmem_data *data)
 {
 	return pmem[id].start_addr(id, data) - pmem[id].base + pmem[id].vbase;
@@ -1289,6 +1665,24 @@ static unsigned long pmem_len_bitmap(int id, struct pmem_data *data)
 	return ret;
 }
 
+static unsigned long pmem_len_extent(int id, struct pmem_data *data)
+{
+	struct pmem_extent *e;
+	unsigned long ret = 0;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	e = extent_find_alloc(id, data->index);
+	if (e)
+		ret = e->quanta * pmem[id].quantum;
+	mutex_unlock(&pmem[id].arena_mutex);
+#if PMEM_DEBUG
+	if (!e)
+		pr_alert("pmem: %s: can't find index %d in the allocated "
+			"extents!\n", __func__, data->index);
+#endif
+	return ret;
+}
+
 static int pmem_map_garbage(int id, struct vm_area_struct *vma,
 			    struct pmem_data *data, unsigned long offset,
 			    unsigned long len)
@@ -1689,17 +2083,122 @@ void flush_pmem_fd(int fd, unsigned long offset, unsigned long len)
 	}
 }
 
-void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
+/* Whether maps of this file go through the cache, see phys_mem_access_prot */
+static int pmem_is_cached_map(struct file *file)
+{
+#ifdef pgprot_writecombine
+	if (file->f_flags & O_SYNC)
+		return 0;
+#endif
+	return pmem[get_id(file)].cached;
+}
+
+static void pmem_account_cache_maint(int id, unsigned long requested,
+		unsigned long done, unsigned long skipped)
+{
+	spin_lock(&pmem[id].cache_stats_lock);
+	pmem[id].cache_maint_requested += requested;
+	pmem[id].cache_maint_done += done;
+	pmem[id].cache_maint_skipped += skipped;
+	spin_unlock(&pmem[id].cache_stats_lock);
+}
+
+static void pmem_flush_range(int id, void *flush_start, unsigned long len)
 {
-	struct pmem_data *data;
-	int id;
-	void *vaddr;
-	struct pmem_region_node *region_node;
-	struct list_head *elt;
-	void *flush_start, *flush_end;
 #ifdef CONFIG_OUTER_CACHE
-	unsigned long phy_start, phy_end;
+	unsigned long phy_start = (unsigned long)flush_start -
+			(unsigned long)pmem[id].vbase + pmem[id].base;
 #endif
+
+	dmac_flush_range(flush_start, flush_start + len);
+#ifdef CONFIG_OUTER_CACHE
+	outer_flush_range(phy_start, phy_start + len);
+#endif
+	pmem_account_cache_maint(id, 0, len, 0);
+}
+
+/* Returns 0 if the range was queued, or if it has to be flushed now because
+ * the queue is full. */
+static int pmem_add_pending_flush(struct pmem_data *data,
+		unsigned long start, unsigned long end)
+{
+	unsigned long flags;
+	int i, ret = 0;
+
+	spin_lock_irqsave(&data->flush_lock, flags);
+	for (i = 0; i < data->nr_pending_flushes; ) {
+		unsigned long p_start = data->pending_flushes[i].start;
+		unsigned long p_end = data->pending_flushes[i].end;
+
+		if (start <= p_end && end >= p_start) {
+			/* take it out and try to merge the union further */
+			start = min(start, p_start);
+			end = max(end, p_end);
+			data->pending_flushes[i] =
+				data->pending_flushes[
+					--data->nr_pending_flushes];
+			i = 0;
+			continue;
+		}
+		i++;
+	}
+	if (data->nr_pending_flushes < PMEM_MAX_PENDING_FLUSHES) {
+		i = data->nr_pending_flushes++;
+		data->pending_flushes[i].start = start;
+		data->pending_flushes[i].end = end;
+	} else {
+		ret = -1;
+	}
+	spin_unlock_irqrestore(&data->flush_lock, flags);
+	return ret;
+}
+
+/* Work out the part of the allocation a flush of offset/len has to cover.
+ * Called with data->sem held, returns 0 if there is nothing to flush.
+ */
+static int pmem_flush_extent(struct file *file, unsigned long offset,
+		unsigned long len, unsigned long *start, unsigned long *end)
+{
+	struct pmem_data *data = file->private_data;
+	int id = get_id(file);
+	struct pmem_region_node *region_node;
+	struct list_head *elt;
+
+	*start = *end = 0;
+	if (!has_allocation(file))
+		return 0;
+
+	/* if this isn't a submmapped file, flush the whole thing */
+	if (unlikely(!(data->flags & PMEM_FLAGS_CONNECTED))) {
+		*end = pmem[id].len(id, data);
+	} else {
+		/* otherwise, flush the region of the file we are drawing */
+		list_for_each(elt, &data->region_list) {
+			region_node = list_entry(elt, struct pmem_region_node,
+						 list);
+			if ((offset >= region_node->region.offset) &&
+			    ((offset + len) <= (region_node->region.offset +
+				region_node->region.len))) {
+				*start = region_node->region.offset;
+				*end = *start + region_node->region.len;
+				break;
+			}
+		}
+	}
+	return *end > *start;
+}
+
+/* Flush, or with queue set queue, the part of a pmem file the hardware is
+ * about to use. The stats count the bytes of the resolved extent, so that
+ * merged queued flushes never count as more than was asked for.
+ */
+static void pmem_flush_or_queue(struct file *file, unsigned long offset,
+		unsigned long len, int queue)
+{
+	struct pmem_data *data;
+	int id;
+	unsigned long start, end;
+
 	if (!is_pmem_file(file))
 		return;
 
@@ -1711,46 +2210,75 @@ void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
 	data = file->private_data;
 
 	down_read(&data->sem);
-	if (!has_allocation(file))
+	if (!pmem_flush_extent(file, offset, len, &start, &end))
+		goto end;
+	if (!pmem_is_cached_map(file)) {
+		pmem_account_cache_maint(id, end - start, 0, end - start);
 		goto end;
+	}
+	pmem_account_cache_maint(id, end - start, 0, 0);
+	if (!queue || pmem_add_pending_flush(data, start, end))
+		pmem_flush_range(id, pmem_start_vaddr(id, data) + start,
+				 end - start);
+end:
+	up_read(&data->sem);
+}
 
-	vaddr = pmem_start_vaddr(id, data);
-	/* if this isn't a submmapped file, flush the whole thing */
-	if (unlikely(!(data->flags & PMEM_FLAGS_CONNECTED))) {
-		dmac_flush_range(vaddr, vaddr + pmem[id].len(id, data));
-#ifdef CONFIG_OUTER_CACHE
-		phy_start = (unsigned long)vaddr -
-				(unsigned long)pmem[id].vbase + pmem[id].base;
+/* Queue a cache flush of the part of a pmem file the hardware is about to
+ * use, pmem_flush_queued does the flushes. Flushes of the same buffer
+ * queued back to back are done once.
+ */
+void pmem_queue_flush(struct file *file, unsigned long offset,
+		unsigned long len)
+{
+	pmem_flush_or_queue(file, offset, len, 1);
+}
+EXPORT_SYMBOL(pmem_queue_flush);
 
-		phy_end  =  phy_start + pmem[id].len(id, data);
+/* Does all the flushes queued on a pmem file. The queue is drained and
+ * flushed with data->sem held for writing, so a caller that finds the queue
+ * already drained waits until whoever drained it is done flushing.
+ */
+void pmem_flush_queued(struct file *file)
+{
+	struct pmem_data *data;
+	int id, i, nr;
+	void *vaddr;
+	unsigned long flags;
+	struct {
+		unsigned long start;
+		unsigned long end;
+	} ranges[PMEM_MAX_PENDING_FLUSHES];
 
-		outer_flush_range(phy_start, phy_end);
-#endif
-		goto end;
-	}
-	/* otherwise, flush the region of the file we are drawing */
-	list_for_each(elt, &data->region_list) {
-		region_node = list_entry(elt, struct pmem_region_node, list);
-		if ((offset >= region_node->region.offset) &&
-		    ((offset + len) <= (region_node->region.offset +
-			region_node->region.len))) {
-			flush_start = vaddr + region_node->region.offset;
-			flush_end = flush_start + region_node->region.len;
-			dmac_flush_range(flush_start, flush_end);
-#ifdef CONFIG_OUTER_CACHE
+	if (!is_pmem_file(file))
+		return;
 
-			phy_start = (unsigned long)flush_start -
-				(unsigned long)pmem[id].vbase + pmem[id].base;
+	id = get_id(file);
+	data = file->private_data;
 
-			phy_end  =  phy_start + region_node->region.len;
+	down_write(&data->sem);
+	spin_lock_irqsave(&data->flush_lock, flags);
+	nr = data->nr_pending_flushes;
+	for (i = 0; i < nr; i++) {
+		ranges[i].start = data->pending_flushes[i].start;
+		ranges[i].end = data->pending_flushes[i].end;
+	}
+	data->nr_pending_flushes = 0;
+	spin_unlock_irqrestore(&data->flush_lock, flags);
 
-			outer_flush_range(phy_start, phy_end);
-#endif
-			break;
-		}
+	if (nr && has_allocation(file)) {
+		vaddr = pmem_start_vaddr(id, data);
+		for (i = 0; i < nr; i++)
+			pmem_flush_range(id, vaddr + ranges[i].start,
+				ranges[i].end - ranges[i].start);
 	}
-end:
-	up_read(&data->sem);
+	up_write(&data->sem);
+}
+EXPORT_SYMBOL(pmem_flush_queued);
+
+void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
+{
+	pmem_flush_or_queue(file, offset, len, 0);
 }
 
 int pmem_cache_maint(struct file *file, unsigned int cmd,
@@ -1774,6 +2302,12 @@ int pmem_cache_maint(struct file *file, unsigned int cmd,
 	offset = pmem_addr->offset;
 	length = pmem_addr->length;
 
+	/* nothing to maintain if the buffer is mapped uncached */
+	if (!pmem_is_cached_map(file)) {
+		pmem_account_cache_maint(id, length, 0, length);
+		return 0;
+	}
+
 	down_read(&data->sem);
 	if (!has_allocation(file)) {
 		up_read(&data->sem);
@@ -1799,6 +2333,7 @@ int pmem_cache_maint(struct file *file, unsigned int cmd,
 		clean_caches(vaddr, length, paddr);
 	else if (cmd == PMEM_INV_CACHES)
 		invalidate_caches(vaddr, length, paddr);
+	pmem_account_cache_maint(id, length, length, 0);
 
 	return 0;
 }
@@ -1903,6 +2438,14 @@ static int pmem_kapi_free_index_bitmap(const int32_t physaddr, int id)
 		bit_from_paddr(id, physaddr) : -1;
 }
 
+static int pmem_kapi_free_index_extent(const int32_t physaddr, int id)
+{
+	return (physaddr >= pmem[id].base &&
+		physaddr < (pmem[id].base + pmem[id].size) &&
+		!((physaddr - pmem[id].base) % pmem[id].quantum)) ?
+		bit_from_paddr(id, physaddr) : -1;
+}
+
 int pmem_kfree(const int32_t physaddr)
 {
 	int i;
@@ -2410,9 +2953,12 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 
 			if (alloc.align != SZ_4K &&
 					(pmem[id].allocator_type !=
-						PMEM_ALLOCATORTYPE_BITMAP)) {
+						PMEM_ALLOCATORTYPE_BITMAP &&
+					pmem[id].allocator_type !=
+						PMEM_ALLOCATORTYPE_EXTENT)) {
 				pr_err("pmem: Non 4k alignment requires bitmap"
-					" allocator on %s\n", pmem[id].name);
+					" or extent allocator on %s\n",
+					pmem[id].name);
 				return -EINVAL;
 			}
 
@@ -2836,6 +3382,43 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 			pmem[id].size, pmem[id].quantum);
 		break;
 
+	case PMEM_ALLOCATORTYPE_EXTENT:
+	{
+		struct pmem_extent *e = kmalloc(sizeof(*e), GFP_KERNEL);
+
+		if (!e) {
+			pr_alert("pmem: %s: Unable to register pmem "
+				"driver %s - can't allocate extent!\n",
+				__func__, pdata->name);
+			goto err_reset_pmem_info;
+		}
+		pmem[id].allocator.extent.free_by_addr = RB_ROOT;
+		pmem[id].allocator.extent.free_by_size = RB_ROOT;
+		pmem[id].allocator.extent.allocated = RB_ROOT;
+		pmem[id].allocator.extent.free_quanta = 0;
+		pmem[id].allocator.extent.free_extents = 0;
+		pmem[id].allocator.extent.allocs = 0;
+		pmem[id].allocator.extent.failures = 0;
+		pmem[id].allocator.extent.frag_failures = 0;
+		e->start = 0;
+		e->quanta = pmem[id].num_entries;
+		extent_add_free(id, e);
+
+		pmem[id].allocate = pmem_allocator_extent;
+		pmem[id].free = pmem_free_extent;
+		pmem[id].free_space = pmem_free_space_extent;
+		pmem[id].kapi_free_index = pmem_kapi_free_index_extent;
+		pmem[id].len = pmem_len_extent;
+		pmem[id].start_addr = pmem_start_addr_extent;
+
+		if (kobject_init_and_add(&pmem[id].kobj,
+				&pmem_extent_ktype, NULL,
+				"%s", pdata->name))
+			goto out_put_kobj;
+
+		break;
+	}
+
 	default:
 		pr_alert("Invalid allocator type (%d) for pmem driver\n",
 			pdata->allocator_type);
@@ -2846,6 +3429,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	pmem[id].release = release;
 	mutex_init(&pmem[id].arena_mutex);
 	mutex_init(&pmem[id].data_list_mutex);
+	spin_lock_init(&pmem[id].cache_stats_lock);
 	INIT_LIST_HEAD(&pmem[id].data_list);
 
 	pmem[id].dev.name = pdata->name;
@@ -2892,7 +3476,8 @@ out_put_kobj:
 	else if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BITMAP) {
 		kfree(pmem[id].allocator.bitmap.bitmap);
 		kfree(pmem[id].allocator.bitmap.bitm_alloc);
-	}
+	} else if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_EXTENT)
+		pmem_extent_destroy(id);
 err_reset_pmem_info:
 	pmem[id].allocate = 0;
 	pmem[id].dev.minor = -1;
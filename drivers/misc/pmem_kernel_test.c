@@ -20,6 +20,8 @@
 #include <linux/android_pmem.h>
 #include <linux/io.h>
 #include <linux/miscdevice.h>
+#include <linux/hrtimer.h>
+#include <linux/random.h>
 
 #define MODULE_NAME "pmem_kernel_test"
 
@@ -55,6 +57,9 @@ module_param_named(run_tests_on_init,
 
 #define NUM_DYN_ALLOCED_BUFFERS 512
 
+#define CHURN_ITERATIONS 4096
+#define CHURN_MAX_PAGES 64
+
 static int read_write_test(void *kernel_addr, unsigned long size)
 {
 	int j, *p;
@@ -539,6 +544,56 @@ done:
 	return ret;
 }
 
+/* Random allocations and frees of 1 to CHURN_MAX_PAGES pages, like camera
+ * and video buffers coming and going, to compare the allocators' failure
+ * rate and latency once the region is fragmented.
+ */
+static int churn_test(void)
+{
+	static int32_t live[NUM_DYN_ALLOCED_BUFFERS];
+	int i, nlive = 0, allocs = 0, failures = 0;
+	s64 total_ns = 0, max_ns = 0;
+
+	for (i = 0; i < CHURN_ITERATIONS; i++) {
+		u32 r = random32();
+		ktime_t start;
+		int32_t ret;
+		s64 ns;
+
+		/* free about a third of the time, and always when full */
+		if (nlive && (nlive == NUM_DYN_ALLOCED_BUFFERS || !(r % 3))) {
+			int victim = (r >> 8) % nlive;
+
+			pmem_kfree(live[victim]);
+			live[victim] = live[--nlive];
+			continue;
+		}
+
+		start = ktime_get();
+		ret = pmem_kalloc((((r >> 8) % CHURN_MAX_PAGES) + 1) *
+				PAGE_SIZE, PMEM_MEMTYPE_EBI1 | PMEM_ALIGNMENT_4K);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		allocs++;
+		total_ns += ns;
+		if (ns > max_ns)
+			max_ns = ns;
+		if (ret <= 0)
+			failures++;
+		else
+			live[nlive++] = ret;
+	}
+	while (nlive)
+		pmem_kfree(live[--nlive]);
+
+	printk(KERN_INFO MODULE_NAME ": %s %d allocations, %d failed "
+		"(%d.%02d%%), latency avg %lld ns max %lld ns\n", __func__,
+		allocs, failures, failures * 100 / allocs,
+		failures * 10000 / allocs % 100,
+		div_s64(total_ns, allocs), max_ns);
+	return 0;
+}
+
 static long pmem_kernel_test_ioctl(struct file *ignored1,
 		unsigned int cmd, unsigned long ignored2)
 {
@@ -553,6 +608,8 @@ static long pmem_kernel_test_ioctl(struct file *ignored1,
 		return free_of_unallocated_test();
 	case PMEM_KERNEL_TEST_LARGE_REGION_NUMBER_TEST_IOCTL:
 		return large_number_of_regions_test();
+	case PMEM_KERNEL_TEST_CHURN_TEST_IOCTL:
+		return churn_test();
 	default:
 		printk(KERN_ERR MODULE_NAME
 			": %s, invalid command %#x\n",
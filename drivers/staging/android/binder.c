@@ -16,9 +16,11 @@
  */
 
 #include <asm/cacheflush.h>
+#include <linux/debugfs.h>
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -29,20 +31,27 @@
 #include <linux/proc_fs.h>
 #include <linux/rbtree.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_SPINLOCK(binder_lru_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
+static LIST_HEAD(binder_lru_procs);
+static int binder_lru_nr_procs;
+static int binder_lru_pages;
 
 static struct proc_dir_entry *binder_proc_dir_entry_root;
 static struct proc_dir_entry *binder_proc_dir_entry_proc;
+static struct dentry *binder_debugfs_dir_entry_root;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
 static int binder_last_id;
@@ -131,7 +140,7 @@ enum binder_stat_types {
 
 struct binder_stats {
 	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	int bc[_IOC_NR(BC_REPLY_SG) + 1];
 	int obj_created[BINDER_STAT_COUNT];
 	int obj_deleted[BINDER_STAT_COUNT];
 };
@@ -194,6 +203,11 @@ struct binder_work {
 	} type;
 };
 
+struct binder_priority {
+	unsigned int sched_policy;
+	int prio;	/* rt_priority for SCHED_FIFO/RR, nice otherwise */
+};
+
 struct binder_node {
 	int debug_id;
 	struct binder_work work;
@@ -214,6 +228,7 @@ struct binder_node {
 	unsigned pending_weak_ref:1;
 	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
+	unsigned inherit_rt:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
 };
@@ -275,15 +290,30 @@ struct binder_proc {
 	struct files_struct *files;
 	struct hlist_node deferred_work_node;
 	int deferred_work;
+	int tmp_ref;
+	int is_dead;
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex alloc_lock; /* buffers, free/allocated trees, pages */
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
+	struct list_head latency_hists;
+	int latency_hist_count;
 
 	struct page **pages;
+	unsigned long *lru_map; /* mapped pages not backing any buffer */
+	struct list_head lru_node;
+	int lru_pages;
+	int pages_mapped;
+	int pages_mapped_max;
+	unsigned int page_allocs;
+	unsigned int page_reuses;
+	unsigned int page_reclaims;
+	size_t allocated_size;
+	size_t allocated_size_max;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -294,7 +324,10 @@ struct binder_proc {
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	struct list_head waiting_threads;
+	unsigned int thread_wakeups;
+	unsigned int spurious_wakeups;
+	struct binder_priority default_priority;
 };
 
 enum {
@@ -309,6 +342,8 @@ enum {
 struct binder_thread {
 	struct binder_proc *proc;
 	struct rb_node rb_node;
+	struct list_head waiting_thread_node;
+	struct task_struct *task;
 	int pid;
 	int looper;
 	struct binder_transaction *transaction_stack;
@@ -330,18 +365,92 @@ struct binder_transaction {
 	struct binder_thread *to_thread;
 	struct binder_transaction *to_parent;
 	unsigned need_reply:1;
+	unsigned set_priority_called:1;
 	/* unsigned is_dead:1; */	/* not used at the moment */
 
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;
+};
+
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
+/*
+ * Reply latency of two-way transactions handled by a proc, per transaction
+ * code.  Bucket i counts replies that took [2^i, 2^(i+1)) microseconds; the
+ * last bucket also takes everything slower.  Codes seen after the first
+ * BINDER_LATENCY_MAX_CODES share the entry with code BINDER_LATENCY_OTHER.
+ */
+#define BINDER_LATENCY_BUCKETS		24
+#define BINDER_LATENCY_MAX_CODES	64
+#define BINDER_LATENCY_OTHER		(~0U)
+
+struct binder_latency_hist {
+	struct list_head entry;
+	unsigned int code;
+	unsigned int count;
+	u64 total_us;
+	u64 max_us;
+	unsigned int buckets[BINDER_LATENCY_BUCKETS];
 };
 
+static void binder_latency_record(struct binder_proc *proc, unsigned int code,
+				  s64 latency_us)
+{
+	struct binder_latency_hist *hist;
+	int bucket;
+
+	list_for_each_entry(hist, &proc->latency_hists, entry) {
+		if (hist->code == code)
+			goto found;
+	}
+	if (proc->latency_hist_count >= BINDER_LATENCY_MAX_CODES) {
+		code = BINDER_LATENCY_OTHER;
+		list_for_each_entry(hist, &proc->latency_hists, entry) {
+			if (hist->code == code)
+				goto found;
+		}
+	}
+	hist = kzalloc(sizeof(*hist), GFP_KERNEL);
+	if (hist == NULL)
+		return;
+	INIT_LIST_HEAD(&hist->entry);
+	hist->code = code;
+	proc->latency_hist_count++;
+found:
+	/* keep the busiest codes at the front */
+	list_move(&hist->entry, &proc->latency_hists);
+	if (latency_us < 0)
+		latency_us = 0;
+	bucket = latency_us ? fls64(latency_us) - 1 : 0;
+	if (bucket >= BINDER_LATENCY_BUCKETS)
+		bucket = BINDER_LATENCY_BUCKETS - 1;
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->total_us += latency_us;
+	if (latency_us > hist->max_us)
+		hist->max_us = latency_us;
+}
+
+static void binder_latency_free(struct binder_proc *proc)
+{
+	struct binder_latency_hist *hist, *tmp;
+
+	list_for_each_entry_safe(hist, tmp, &proc->latency_hists, entry) {
+		list_del(&hist->entry);
+		kfree(hist);
+	}
+	proc->latency_hist_count = 0;
+}
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_proc_dec_tmpref(struct binder_proc *proc);
 
 /*
  * copied from get_unused_fd_flags
@@ -481,21 +590,123 @@ out_unlock:
 	return -EBADF;
 }
 
-static void binder_set_nice(long nice)
+static void binder_set_nice(struct task_struct *task, long nice)
 {
 	long min_nice;
-	if (can_nice(current, nice)) {
-		set_user_nice(current, nice);
+	if (can_nice(task, nice)) {
+		set_user_nice(task, nice);
 		return;
 	}
-	min_nice = 20 - current->signal->rlim[RLIMIT_NICE].rlim_cur;
+	min_nice = 20 - task->signal->rlim[RLIMIT_NICE].rlim_cur;
 	binder_debug(BINDER_DEBUG_PRIORITY_CAP,
 		     "binder: %d: nice value %ld not allowed use "
-		     "%ld instead\n", current->pid, nice, min_nice);
-	set_user_nice(current, min_nice);
+		     "%ld instead\n", task->pid, nice, min_nice);
+	set_user_nice(task, min_nice);
 	if (min_nice < 20)
 		return;
-	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
+	binder_user_error("binder: %d RLIMIT_NICE not set\n", task->pid);
+}
+
+static int binder_is_rt_policy(unsigned int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static void binder_get_priority(struct task_struct *task,
+				struct binder_priority *p)
+{
+	p->sched_policy = task->policy;
+	if (binder_is_rt_policy(task->policy))
+		p->prio = task->rt_priority;
+	else
+		p->prio = task_nice(task);
+}
+
+static void binder_set_priority(struct task_struct *task,
+				struct binder_priority desired)
+{
+	struct sched_param params;
+
+	if (binder_is_rt_policy(desired.sched_policy)) {
+		if (task->policy == desired.sched_policy &&
+		    task->rt_priority == desired.prio)
+			return;
+		params.sched_priority = desired.prio;
+		sched_setscheduler_nocheck(task, desired.sched_policy, &params);
+		return;
+	}
+	if (task->policy != desired.sched_policy) {
+		params.sched_priority = 0;
+		sched_setscheduler_nocheck(task, desired.sched_policy, &params);
+	}
+	binder_set_nice(task, desired.prio);
+}
+
+/*
+ * Run the thread handling t at the caller's priority, but never below the
+ * floor set by the target node.  Real-time callers only pass their policy
+ * on to nodes that asked for it with FLAT_BINDER_FLAG_INHERIT_RT, everyone
+ * else sees them as nice 0.  One-way calls only get the node's floor.  The
+ * previous priority is saved in t and restored when the reply is sent.
+ */
+static void binder_transaction_priority(struct task_struct *task,
+					struct binder_transaction *t,
+					struct binder_node *node)
+{
+	struct binder_priority desired = t->priority;
+	struct binder_priority node_prio;
+
+	if (t->set_priority_called)
+		return;
+	t->set_priority_called = 1;
+	binder_get_priority(task, &t->saved_priority);
+
+	node_prio.sched_policy = SCHED_NORMAL;
+	node_prio.prio = node->min_priority;
+	if (t->flags & TF_ONE_WAY) {
+		if (!binder_is_rt_policy(t->saved_priority.sched_policy) &&
+		    t->saved_priority.prio > node_prio.prio)
+			binder_set_priority(task, node_prio);
+		return;
+	}
+	if (binder_is_rt_policy(desired.sched_policy) && !node->inherit_rt) {
+		desired.sched_policy = SCHED_NORMAL;
+		desired.prio = 0;
+	}
+	if (!binder_is_rt_policy(desired.sched_policy) &&
+	    desired.prio > node_prio.prio)
+		desired = node_prio;
+	binder_set_priority(task, desired);
+}
+
+/*
+ * Threads blocked in binder_thread_read waiting for process work sit on
+ * proc->waiting_threads, most recently idle first.  New work is handed to
+ * one of them instead of waking every looper on proc->wait.
+ */
+static struct binder_thread *binder_select_thread(struct binder_proc *proc)
+{
+	struct binder_thread *thread;
+
+	if (list_empty(&proc->waiting_threads))
+		return NULL;
+	thread = list_first_entry(&proc->waiting_threads,
+				  struct binder_thread, waiting_thread_node);
+	list_del_init(&thread->waiting_thread_node);
+	proc->thread_wakeups++;
+	return thread;
+}
+
+static void binder_wakeup_proc(struct binder_proc *proc)
+{
+	struct binder_thread *thread = binder_select_thread(proc);
+
+	if (thread) {
+		wake_up_interruptible(&thread->wait);
+		return;
+	}
+	/* nobody blocked in read, wake pollers */
+	wake_up_interruptible(&proc->wait);
 }
 
 static size_t binder_buffer_size(struct binder_proc *proc,
@@ -590,6 +801,64 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_lru_add_range(struct binder_proc *proc,
+				 void *start, void *end)
+{
+	void *page_addr;
+	int count = 0;
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		int index = (page_addr - proc->buffer) / PAGE_SIZE;
+
+		BUG_ON(!proc->pages[index]);
+		BUG_ON(test_bit(index, proc->lru_map));
+		set_bit(index, proc->lru_map);
+		count++;
+	}
+	proc->lru_pages += count;
+
+	spin_lock(&binder_lru_lock);
+	if (list_empty(&proc->lru_node))
+		binder_lru_nr_procs++;
+	list_move_tail(&proc->lru_node, &binder_lru_procs);
+	binder_lru_pages += count;
+	spin_unlock(&binder_lru_lock);
+}
+
+static void binder_lru_del_page(struct binder_proc *proc, int index)
+{
+	clear_bit(index, proc->lru_map);
+	proc->lru_pages--;
+
+	spin_lock(&binder_lru_lock);
+	binder_lru_pages--;
+	if (!proc->lru_pages) {
+		list_del_init(&proc->lru_node);
+		binder_lru_nr_procs--;
+	}
+	spin_unlock(&binder_lru_lock);
+}
+
+static void binder_free_page(struct binder_proc *proc, int index,
+			     struct vm_area_struct *vma)
+{
+	void *page_addr = proc->buffer + index * PAGE_SIZE;
+
+	if (vma)
+		zap_page_range(vma, (uintptr_t)page_addr +
+			proc->user_buffer_offset, PAGE_SIZE, NULL);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(proc->pages[index]);
+	proc->pages[index] = NULL;
+	proc->pages_mapped--;
+}
+
+/*
+ * Pages released by a freed buffer stay mapped and are only marked idle
+ * in lru_map, so the next buffer that covers them needs neither mmap_sem
+ * nor a page allocation.  binder_shrink hands idle pages back under
+ * memory pressure.  Missing pages are allocated and mapped in runs.
+ */
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -597,8 +866,10 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct page **page_array_ptr;
 	struct mm_struct *mm;
+	int index;
+	int need_map = 0;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -607,6 +878,21 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0) {
+		binder_lru_add_range(proc, start, end);
+		return 0;
+	}
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		index = (page_addr - proc->buffer) / PAGE_SIZE;
+		if (!proc->pages[index])
+			need_map = 1;
+		else
+			BUG_ON(!test_bit(index, proc->lru_map));
+	}
+	if (!need_map)
+		goto reuse_pages;
+
 	if (vma)
 		mm = NULL;
 	else
@@ -617,68 +903,91 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		vma = proc->vma;
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
 		goto err_no_vma;
 	}
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+	page_addr = start;
+	while (page_addr < end) {
+		void *run_start;
+		int run_index;
 		int ret;
-		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
+		index = (page_addr - proc->buffer) / PAGE_SIZE;
+		if (proc->pages[index]) {
+			page_addr += PAGE_SIZE;
+			continue;
+		}
+
+		run_start = page_addr;
+		run_index = index;
+		while (page_addr < end && !proc->pages[index]) {
+			proc->pages[index] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+			if (proc->pages[index] == NULL) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed for page at %p\n",
+				       proc->pid, page_addr);
+				goto err_alloc_page_failed;
+			}
+			proc->pages_mapped++;
+			proc->page_allocs++;
+			page_addr += PAGE_SIZE;
+			index++;
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+
+		tmp_area.addr = run_start;
+		tmp_area.size = page_addr - run_start + PAGE_SIZE /* guard page? */;
+		page_array_ptr = &proc->pages[run_index];
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
+			       "to map pages at %p-%p in kernel\n",
+			       proc->pid, run_start, page_addr);
 			goto err_map_kernel_failed;
 		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %lx in userspace\n",
-			       proc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
+		for (index = run_index; run_start < page_addr;
+		     run_start += PAGE_SIZE, index++) {
+			user_page_addr =
+				(uintptr_t)run_start + proc->user_buffer_offset;
+			ret = vm_insert_page(vma, user_page_addr,
+					     proc->pages[index]);
+			if (ret) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed to map page at %lx in "
+				       "userspace\n", proc->pid,
+				       user_page_addr);
+				goto err_vm_insert_page_failed;
+			}
+			/* vm_insert_page does not seem to increment the refcount */
 		}
-		/* vm_insert_page does not seem to increment the refcount */
 	}
+	if (proc->pages_mapped > proc->pages_mapped_max)
+		proc->pages_mapped_max = proc->pages_mapped;
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
 	}
+
+reuse_pages:
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		index = (page_addr - proc->buffer) / PAGE_SIZE;
+		if (test_bit(index, proc->lru_map)) {
+			binder_lru_del_page(proc, index);
+			proc->page_reuses++;
+		}
+	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
 err_alloc_page_failed:
-		;
+	/* drop every page of the range that was not already mapped and idle */
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		index = (page_addr - proc->buffer) / PAGE_SIZE;
+		if (proc->pages[index] && !test_bit(index, proc->lru_map))
+			binder_free_page(proc, index, vma);
 	}
 err_no_vma:
 	if (mm) {
@@ -688,9 +997,10 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static struct binder_buffer *binder_alloc_buf_locked(struct binder_proc *proc,
+						     size_t data_size,
+						     size_t offsets_size,
+						     int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -770,6 +1080,14 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
+	/*
+	 * The buffer is visible to BC_FREE_BUFFER lookups as soon as it is
+	 * in allocated_buffers, so clear any state left by a previous user
+	 * before the caller drops alloc_lock.
+	 */
+	buffer->allow_user_free = 0;
+	buffer->transaction = NULL;
+	buffer->target_node = NULL;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
@@ -783,6 +1101,10 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	trace_binder_alloc_buf(proc, buffer);
+	proc->allocated_size += size;
+	if (proc->allocated_size > proc->allocated_size_max)
+		proc->allocated_size_max = proc->allocated_size;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -794,6 +1116,19 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = binder_alloc_buf_locked(proc, data_size, offsets_size,
+					 is_async);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -851,8 +1186,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void binder_free_buf_locked(struct binder_proc *proc,
+				   struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -871,6 +1206,8 @@ static void binder_free_buf(struct binder_proc *proc,
 	BUG_ON((void *)buffer < proc->buffer);
 	BUG_ON((void *)buffer > proc->buffer + proc->buffer_size);
 
+	trace_binder_free_buf(proc, buffer);
+	proc->allocated_size -= size;
 	if (buffer->async_transaction) {
 		proc->free_async_space += size + sizeof(struct binder_buffer);
 
@@ -906,6 +1243,86 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	binder_free_buf_locked(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
+static int binder_shrink_proc(struct binder_proc *proc, int nr_to_scan)
+{
+	struct vm_area_struct *vma = NULL;
+	struct mm_struct *mm;
+	int npages = proc->buffer_size / PAGE_SIZE;
+	int index;
+	int freed = 0;
+
+	mm = get_task_mm(proc->tsk);
+	if (mm) {
+		if (!down_read_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			return 0;
+		}
+		vma = proc->vma;
+	}
+	for (index = find_first_bit(proc->lru_map, npages);
+	     index < npages && freed < nr_to_scan;
+	     index = find_next_bit(proc->lru_map, npages, index + 1)) {
+		binder_lru_del_page(proc, index);
+		binder_free_page(proc, index, vma);
+		proc->page_reclaims++;
+		freed++;
+	}
+	if (mm) {
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: shrinker freed %d idle pages\n",
+		     proc->pid, freed);
+	return freed;
+}
+
+/*
+ * binder_shrink - give back pages kept mapped by freed buffers
+ *
+ * Procs are visited least recently freed first.  A proc whose alloc_lock
+ * is busy is skipped: the allocation that holds it may be the one that
+ * sent us into reclaim.
+ */
+static int binder_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct binder_proc *proc;
+	int tries;
+
+	if (!nr_to_scan)
+		return binder_lru_pages;
+
+	spin_lock(&binder_lru_lock);
+	for (tries = binder_lru_nr_procs; tries > 0 && nr_to_scan > 0 &&
+	     !list_empty(&binder_lru_procs); tries--) {
+		proc = list_first_entry(&binder_lru_procs, struct binder_proc,
+					lru_node);
+		list_move_tail(&proc->lru_node, &binder_lru_procs);
+		if (!mutex_trylock(&proc->alloc_lock))
+			continue;
+		spin_unlock(&binder_lru_lock);
+		nr_to_scan -= binder_shrink_proc(proc, nr_to_scan);
+		mutex_unlock(&proc->alloc_lock);
+		spin_lock(&binder_lru_lock);
+	}
+	spin_unlock(&binder_lru_lock);
+
+	return binder_lru_pages;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -1018,7 +1435,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
 		if (list_empty(&node->work.entry)) {
 			list_add_tail(&node->work.entry, &node->proc->todo);
-			wake_up_interruptible(&node->proc->wait);
+			binder_wakeup_proc(node->proc);
 		}
 	} else {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
@@ -1358,9 +1775,33 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+static int binder_copy_sg(void *data, size_t data_size,
+			  const struct binder_sg_entry __user *sg,
+			  size_t sg_count)
+{
+	struct binder_sg_entry entry;
+	size_t pos = 0;
+
+	if (sg_count > UIO_MAXIOV)
+		return -EINVAL;
+	for (; sg_count; sg_count--, sg++) {
+		if (copy_from_user(&entry, sg, sizeof(entry)))
+			return -EFAULT;
+		if (entry.length > data_size - pos)
+			return -EINVAL;
+		if (copy_from_user(data + pos, entry.buffer, entry.length))
+			return -EFAULT;
+		pos += entry.length;
+	}
+	return pos == data_size ? 0 : -EINVAL;
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
-			       struct binder_transaction_data *tr, int reply)
+			       struct binder_transaction_data *tr, int reply,
+			       int is_sg,
+			       const struct binder_sg_entry __user *sg,
+			       size_t sg_count)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
@@ -1372,6 +1813,7 @@ static void binder_transaction(struct binder_proc *proc,
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
+	const char *copy_error;
 	uint32_t return_error;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
@@ -1382,6 +1824,13 @@ static void binder_transaction(struct binder_proc *proc,
 	e->data_size = tr->data_size;
 	e->offsets_size = tr->offsets_size;
 
+	if (is_sg && sg == NULL && sg_count) {
+		binder_user_error("binder: %d:%d got sg transaction with no "
+				  "buffer list\n", proc->pid, thread->pid);
+		return_error = BR_FAILED_REPLY;
+		goto err_bad_sg_list;
+	}
+
 	if (reply) {
 		in_reply_to = thread->transaction_stack;
 		if (in_reply_to == NULL) {
@@ -1391,7 +1840,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_set_priority(current, in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1464,21 +1913,8 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1525,34 +1961,97 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	binder_get_priority(current, &t->priority);
+	t->start_time = ktime_get();
+
+	/*
+	 * Allocating the target buffer may map pages under the target's
+	 * mmap_sem, and copying the payload may fault, so both are done
+	 * without binder_lock.  The target proc is pinned by tmp_ref, and
+	 * the buffer is not reachable from any work list until it is
+	 * queued below.  Everything else, including target_node, must be
+	 * revalidated after the lock is retaken.
+	 */
+	target_proc->tmp_ref++;
+	mutex_unlock(&binder_lock);
+	copy_error = NULL;
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+	if (t->buffer) {
+		t->buffer->debug_id = t->debug_id;
+		offp = (size_t *)(t->buffer->data +
+				  ALIGN(tr->data_size, sizeof(void *)));
+		if (is_sg ? binder_copy_sg(t->buffer->data, tr->data_size,
+					sg, sg_count) :
+			    copy_from_user(t->buffer->data, tr->data.ptr.buffer,
+					tr->data_size))
+			copy_error = is_sg ? "scatter-gather data" : "data";
+		else if (copy_from_user(offp, tr->data.ptr.offsets,
+					tr->offsets_size))
+			copy_error = "offsets";
+	}
+	mutex_lock(&binder_lock);
+
+	if (target_proc->is_dead) {
+		/* the buffer, if any, is freed along with target_proc */
+		return_error = BR_DEAD_REPLY;
+		goto err_target_proc_dead;
+	}
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
-
-	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
+	if (target_node) {
+		struct binder_ref *ref;
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+		/*
+		 * The sender may have dropped its last ref to target_node
+		 * while the lock was released, so look it up again before
+		 * taking the transaction's ref on it.
+		 */
+		if (tr->target.handle) {
+			ref = binder_get_ref(proc, tr->target.handle);
+			if (ref == NULL || ref->node != target_node)
+				target_node = NULL;
+		} else if (target_node != binder_context_mgr_node)
+			target_node = NULL;
+		if (target_node == NULL || target_node->proc != target_proc) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_target_node;
+		}
+		binder_inc_node(target_node, 1, 0, NULL);
+		t->buffer->target_node = target_node;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
+	t->buffer->transaction = t;
+	if (copy_error) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
+			"%s ptr\n", proc->pid, thread->pid, copy_error);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
+	if (reply) {
+		if (in_reply_to->from == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_target_thread;
+		}
+	} else if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp;
+		tmp = thread->transaction_stack;
+		while (tmp) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+			tmp = tmp->from_parent;
+		}
+	}
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		t->to_thread = target_thread;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1585,6 +2084,7 @@ static void binder_transaction(struct binder_proc *proc,
 					goto err_binder_new_node_failed;
 				}
 				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+				node->inherit_rt = !!(fp->flags & FLAT_BINDER_FLAG_INHERIT_RT);
 				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
@@ -1698,7 +2198,13 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
+	trace_binder_transaction(reply, t, target_node);
 	if (reply) {
+		s64 latency_us = ktime_us_delta(t->start_time,
+						in_reply_to->start_time);
+
+		trace_binder_transaction_done(proc, in_reply_to, latency_us);
+		binder_latency_record(proc, in_reply_to->code, latency_us);
 		BUG_ON(t->buffer->async_transaction != 0);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
@@ -1715,12 +2221,24 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	if (!target_thread && target_wait) {
+		target_thread = binder_select_thread(target_proc);
+		if (target_thread) {
+			target_list = &target_thread->todo;
+			target_wait = &target_thread->wait;
+		}
+	}
+	/* boost the handler before it runs, not once it gets to read */
+	if (target_thread && !reply)
+		binder_transaction_priority(target_thread->task, t,
+					    target_node);
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	binder_proc_dec_tmpref(target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1732,10 +2250,14 @@ err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
 err_copy_data_failed:
+err_dead_target_thread:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
+err_dead_target_node:
 	binder_free_buf(target_proc, t->buffer);
 err_binder_alloc_buf_failed:
+err_target_proc_dead:
+	binder_proc_dec_tmpref(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1747,6 +2269,7 @@ err_empty_call_stack:
 err_dead_binder:
 err_invalid_target_handle:
 err_no_context_mgr_node:
+err_bad_sg_list:
 	binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 		     "binder: %d:%d transaction failed %d, size %zd-%zd\n",
 		     proc->pid, thread->pid, return_error,
@@ -1916,7 +2439,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->alloc_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
+			mutex_unlock(&proc->alloc_lock);
 			if (buffer == NULL) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
@@ -1958,7 +2483,21 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			binder_transaction(proc, thread, &tr, cmd == BC_REPLY,
+					   0, NULL, 0);
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				return -EFAULT;
+			ptr += sizeof(tr);
+			binder_transaction(proc, thread, &tr.transaction_data,
+					   cmd == BC_REPLY_SG, 1, tr.buffers,
+					   tr.buffers_count);
 			break;
 		}
 
@@ -2066,7 +2605,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
-						wake_up_interruptible(&proc->wait);
+						binder_wakeup_proc(proc);
 					}
 				}
 			} else {
@@ -2096,7 +2635,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						list_add_tail(&death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&death->work.entry, &proc->todo);
-						wake_up_interruptible(&proc->wait);
+						binder_wakeup_proc(proc);
 					}
 				} else {
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
@@ -2136,7 +2675,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					list_add_tail(&death->work.entry, &thread->todo);
 				} else {
 					list_add_tail(&death->work.entry, &proc->todo);
-					wake_up_interruptible(&proc->wait);
+					binder_wakeup_proc(proc);
 				}
 			}
 		} break;
@@ -2164,7 +2703,7 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 static int binder_has_proc_work(struct binder_proc *proc,
 				struct binder_thread *thread)
 {
-	return !list_empty(&proc->todo) ||
+	return !list_empty(&proc->todo) || !list_empty(&thread->todo) ||
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
 }
 
@@ -2213,8 +2752,17 @@ retry:
 
 
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
-	if (wait_for_proc_work)
+	if (wait_for_proc_work) {
 		proc->ready_threads++;
+		/*
+		 * Drop back to the default priority before we become
+		 * selectable, binder_transaction may boost us right after.
+		 */
+		binder_set_priority(current, proc->default_priority);
+		if (!non_block)
+			list_add(&thread->waiting_thread_node,
+				 &proc->waiting_threads);
+	}
 	mutex_unlock(&binder_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
@@ -2226,12 +2774,11 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
 		} else
-			ret = wait_event_interruptible_exclusive(proc->wait, binder_has_proc_work(proc, thread));
+			ret = wait_event_interruptible(thread->wait, binder_has_proc_work(proc, thread));
 	} else {
 		if (non_block) {
 			if (!binder_has_thread_work(thread))
@@ -2240,8 +2787,11 @@ retry:
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
 	mutex_lock(&binder_lock);
-	if (wait_for_proc_work)
+	trace_binder_thread_wakeup(thread, wait_for_proc_work, ret);
+	if (wait_for_proc_work) {
 		proc->ready_threads--;
+		list_del_init(&thread->waiting_thread_node);
+	}
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
 
 	if (ret)
@@ -2258,8 +2808,11 @@ retry:
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
 			w = list_first_entry(&proc->todo, struct binder_work, entry);
 		else {
-			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
+			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) { /* no data added */
+				if (wait_for_proc_work)
+					proc->spurious_wakeups++;
 				goto retry;
+			}
 			break;
 		}
 
@@ -2389,13 +2942,7 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_transaction_priority(current, t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2430,6 +2977,7 @@ retry:
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		trace_binder_transaction_received(thread, t);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2522,6 +3070,9 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		binder_stats_created(BINDER_STAT_THREAD);
 		thread->proc = proc;
 		thread->pid = current->pid;
+		get_task_struct(current);
+		thread->task = current;
+		INIT_LIST_HEAD(&thread->waiting_thread_node);
 		init_waitqueue_head(&thread->wait);
 		INIT_LIST_HEAD(&thread->todo);
 		rb_link_node(&thread->rb_node, parent, p);
@@ -2569,6 +3120,8 @@ static int binder_free_thread(struct binder_proc *proc,
 	if (send_reply)
 		binder_send_failed_reply(send_reply, BR_DEAD_REPLY);
 	binder_release_work(&thread->todo);
+	list_del(&thread->waiting_thread_node);
+	put_task_struct(thread->task);
 	kfree(thread);
 	binder_stats_deleted(BINDER_STAT_THREAD);
 	return active_transactions;
@@ -2653,7 +3206,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		if (bwr.read_size > 0) {
 			ret = binder_thread_read(proc, thread, (void __user *)bwr.read_buffer, bwr.read_size, &bwr.read_consumed, filp->f_flags & O_NONBLOCK);
 			if (!list_empty(&proc->todo))
-				wake_up_interruptible(&proc->wait);
+				binder_wakeup_proc(proc);
 			if (ret < 0) {
 				if (copy_to_user(ubuf, &bwr, sizeof(bwr)))
 					ret = -EFAULT;
@@ -2815,6 +3368,12 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		failure_string = "alloc page array";
 		goto err_alloc_pages_failed;
 	}
+	proc->lru_map = kzalloc(BITS_TO_LONGS((vma->vm_end - vma->vm_start) / PAGE_SIZE) * sizeof(long), GFP_KERNEL);
+	if (proc->lru_map == NULL) {
+		ret = -ENOMEM;
+		failure_string = "alloc page lru map";
+		goto err_alloc_lru_map_failed;
+	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
 
 	vma->vm_ops = &binder_vm_ops;
@@ -2840,6 +3399,9 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	return 0;
 
 err_alloc_small_buf_failed:
+	kfree(proc->lru_map);
+	proc->lru_map = NULL;
+err_alloc_lru_map_failed:
 	kfree(proc->pages);
 	proc->pages = NULL;
 err_alloc_pages_failed:
@@ -2867,7 +3429,11 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
+	mutex_init(&proc->alloc_lock);
+	INIT_LIST_HEAD(&proc->lru_node);
+	INIT_LIST_HEAD(&proc->latency_hists);
+	INIT_LIST_HEAD(&proc->waiting_threads);
+	binder_get_priority(current, &proc->default_priority);
 	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
@@ -2930,12 +3496,90 @@ static int binder_release(struct inode *nodp, struct file *filp)
 	return 0;
 }
 
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	BUG_ON(proc->tmp_ref);
+
+	buffers = 0;
+	mutex_lock(&proc->alloc_lock);
+	while ((n = rb_first(&proc->allocated_buffers))) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		t = buffer->transaction;
+		if (t) {
+			t->buffer = NULL;
+			buffer->transaction = NULL;
+			printk(KERN_ERR "binder: release proc %d, "
+			       "transaction %d, not freed\n",
+			       proc->pid, t->debug_id);
+			/*BUG();*/
+		}
+		binder_free_buf_locked(proc, buffer);
+		buffers++;
+	}
+	spin_lock(&binder_lru_lock);
+	binder_lru_pages -= proc->lru_pages;
+	if (!list_empty(&proc->lru_node)) {
+		list_del_init(&proc->lru_node);
+		binder_lru_nr_procs--;
+	}
+	spin_unlock(&binder_lru_lock);
+	mutex_unlock(&proc->alloc_lock);
+
+	page_count = 0;
+	if (proc->pages) {
+		int i;
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+			if (proc->pages[i]) {
+				void *page_addr = proc->buffer + i * PAGE_SIZE;
+				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+					     "binder_release: %d: "
+					     "page %d at %p not freed\n",
+					     proc->pid, i,
+					     page_addr);
+				unmap_kernel_range((unsigned long)page_addr,
+					PAGE_SIZE);
+				__free_page(proc->pages[i]);
+				page_count++;
+			}
+		}
+		kfree(proc->pages);
+		kfree(proc->lru_map);
+		vfree(proc->buffer);
+	}
+
+	binder_latency_free(proc);
+	put_task_struct(proc->tsk);
+
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
+
+	kfree(proc);
+}
+
+/*
+ * Drop a reference taken while binder_lock was released.  A proc that
+ * binder_deferred_release tore down in the meantime is freed by whoever
+ * drops the last reference.  Called with binder_lock held.
+ */
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_ref <= 0);
+	proc->tmp_ref--;
+	if (proc->is_dead && !proc->tmp_ref)
+		binder_free_proc(proc);
+}
+
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
@@ -2982,7 +3626,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 					if (list_empty(&ref->death->work.entry)) {
 						ref->death->work.type = BINDER_WORK_DEAD_BINDER;
 						list_add_tail(&ref->death->work.entry, &ref->proc->todo);
-						wake_up_interruptible(&ref->proc->wait);
+						binder_wakeup_proc(ref->proc);
 					} else
 						BUG();
 				}
@@ -3001,57 +3645,19 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
-
-	while ((n = rb_first(&proc->allocated_buffers))) {
-		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
-							rb_node);
-		t = buffer->transaction;
-		if (t) {
-			t->buffer = NULL;
-			buffer->transaction = NULL;
-			printk(KERN_ERR "binder: release proc %d, "
-			       "transaction %d, not freed\n",
-			       proc->pid, t->debug_id);
-			/*BUG();*/
-		}
-		binder_free_buf(proc, buffer);
-		buffers++;
-	}
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
-	page_count = 0;
-	if (proc->pages) {
-		int i;
-		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
-				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
-				unmap_kernel_range((unsigned long)page_addr,
-					PAGE_SIZE);
-				__free_page(proc->pages[i]);
-				page_count++;
-			}
-		}
-		kfree(proc->pages);
-		vfree(proc->buffer);
-	}
-
-	put_task_struct(proc->tsk);
-
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
 		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
+		     "refs %d, active transactions %d%s\n",
 		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     active_transactions,
+		     proc->tmp_ref ? ", deferred free" : "");
 
-	kfree(proc);
+	proc->is_dead = 1;
+	if (!proc->tmp_ref)
+		binder_free_proc(proc);
 }
 
 static void binder_deferred_func(struct work_struct *work)
@@ -3113,13 +3719,14 @@ static char *print_binder_transaction(char *buf, char *end, const char *prefix,
 {
 	buf += snprintf(buf, end - buf,
 			"%s %d: %p from %d:%d to %d:%d code %x "
-			"flags %x pri %ld r%d",
+			"flags %x pri %d:%d r%d",
 			prefix, t->debug_id, t,
 			t->from ? t->from->proc->pid : 0,
 			t->from ? t->from->pid : 0,
 			t->to_proc ? t->to_proc->pid : 0,
 			t->to_thread ? t->to_thread->pid : 0,
-			t->code, t->flags, t->priority, t->need_reply);
+			t->code, t->flags, t->priority.sched_policy,
+			t->priority.prio, t->need_reply);
 	if (buf >= end)
 		return buf;
 	if (t->buffer == NULL) {
@@ -3313,12 +3920,14 @@ static char *print_binder_proc(char *buf, char *end,
 					       rb_entry(n, struct binder_ref,
 							rb_node_desc));
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers);
 	     n != NULL && buf < end;
 	     n = rb_next(n))
 		buf = print_binder_buffer(buf, end, "  buffer",
 					  rb_entry(n, struct binder_buffer,
 						   rb_node));
+	mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry) {
 		if (buf >= end)
 			break;
@@ -3375,7 +3984,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3438,6 +4049,8 @@ static char *print_binder_proc_stats(char *buf, char *end,
 	struct binder_work *w;
 	struct rb_node *n;
 	int count, strong, weak;
+	int free_count;
+	size_t free_size, free_max;
 
 	buf += snprintf(buf, end - buf, "proc %d\n", proc->pid);
 	if (buf >= end)
@@ -3450,9 +4063,11 @@ static char *print_binder_proc_stats(char *buf, char *end,
 		return buf;
 	buf += snprintf(buf, end - buf, "  requested threads: %d+%d/%d\n"
 			"  ready threads %d\n"
+			"  wakeups %u, spurious %u\n"
 			"  free async space %zd\n", proc->requested_threads,
 			proc->requested_threads_started, proc->max_threads,
-			proc->ready_threads, proc->free_async_space);
+			proc->ready_threads, proc->thread_wakeups,
+			proc->spurious_wakeups, proc->free_async_space);
 	if (buf >= end)
 		return buf;
 	count = 0;
@@ -3477,9 +4092,31 @@ static char *print_binder_proc_stats(char *buf, char *end,
 		return buf;
 
 	count = 0;
+	free_count = 0;
+	free_size = 0;
+	free_max = 0;
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
-	buf += snprintf(buf, end - buf, "  buffers: %d\n", count);
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		size_t size = binder_buffer_size(proc, rb_entry(n,
+					struct binder_buffer, rb_node));
+		free_count++;
+		free_size += size;
+		if (size > free_max)
+			free_max = size;
+	}
+	buf += snprintf(buf, end - buf, "  buffers: %d\n"
+			"  allocated space %zd max %zd\n"
+			"  free space %zd in %d chunks, largest %zd\n"
+			"  pages: %d mapped max %d, %d idle\n"
+			"  page allocs %u reuses %u reclaims %u\n", count,
+			proc->allocated_size, proc->allocated_size_max,
+			free_size, free_count, free_max,
+			proc->pages_mapped, proc->pages_mapped_max,
+			proc->lru_pages, proc->page_allocs,
+			proc->page_reuses, proc->page_reclaims);
+	mutex_unlock(&proc->alloc_lock);
 	if (buf >= end)
 		return buf;
 
@@ -3569,6 +4206,10 @@ static int binder_read_proc_stats(char *page, char **start, off_t off,
 	p += snprintf(p, PAGE_SIZE, "binder stats:\n");
 
 	p = print_binder_stats(p, page + PAGE_SIZE, "", &binder_stats);
+	if (p < page + PAGE_SIZE)
+		p += snprintf(p, page + PAGE_SIZE - p,
+			      "idle pages: %d in %d procs\n",
+			      binder_lru_pages, binder_lru_nr_procs);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
 		if (p >= page + PAGE_SIZE)
@@ -3711,6 +4352,68 @@ static int binder_read_proc_transaction_log(
 	return len < count ? len  : count;
 }
 
+static void print_binder_latency_hist(struct seq_file *m,
+				      struct binder_latency_hist *hist)
+{
+	int i, last;
+
+	if (hist->code == BINDER_LATENCY_OTHER)
+		seq_printf(m, "  code other:");
+	else
+		seq_printf(m, "  code %x:", hist->code);
+	seq_printf(m, " count %u avg %llu max %llu us\n", hist->count,
+		   div_u64(hist->total_us, hist->count),
+		   (unsigned long long)hist->max_us);
+	for (last = BINDER_LATENCY_BUCKETS - 1; last > 0; last--)
+		if (hist->buckets[last])
+			break;
+	for (i = 0; i <= last; i++) {
+		if (!hist->buckets[i])
+			continue;
+		if (i == BINDER_LATENCY_BUCKETS - 1)
+			seq_printf(m, "    %8lu+ us: %u\n", 1UL << i,
+				   hist->buckets[i]);
+		else
+			seq_printf(m, "    %8lu-%lu us: %u\n", 1UL << i,
+				   (2UL << i) - 1, hist->buckets[i]);
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct binder_latency_hist *hist;
+	struct hlist_node *pos;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		mutex_lock(&binder_lock);
+	seq_printf(m, "binder reply latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (list_empty(&proc->latency_hists))
+			continue;
+		seq_printf(m, "proc %d\n", proc->pid);
+		list_for_each_entry(hist, &proc->latency_hists, entry)
+			print_binder_latency_hist(m, hist);
+	}
+	if (do_lock)
+		mutex_unlock(&binder_lock);
+	return 0;
+}
+
+static int binder_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, binder_latency_show, inode->i_private);
+}
+
+static const struct file_operations binder_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = binder_latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static const struct file_operations binder_fops = {
 	.owner = THIS_MODULE,
 	.poll = binder_poll,
@@ -3740,6 +4443,12 @@ static int __init binder_init(void)
 		binder_proc_dir_entry_proc = proc_mkdir("proc",
 						binder_proc_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_shrinker);
+	binder_debugfs_dir_entry_root = debugfs_create_dir("binder", NULL);
+	if (binder_debugfs_dir_entry_root)
+		debugfs_create_file("latency", S_IRUGO,
+				    binder_debugfs_dir_entry_root, NULL,
+				    &binder_latency_fops);
 	if (binder_proc_dir_entry_root) {
 		create_proc_read_entry("state",
 				       S_IRUGO,
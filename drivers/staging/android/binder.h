@@ -37,6 +37,7 @@ enum {
 enum {
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	FLAT_BINDER_FLAG_INHERIT_RT = 0x200,
 };
 
 /*
@@ -147,6 +148,23 @@ struct binder_transaction_data {
 	} data;
 };
 
+/*
+ * BC_TRANSACTION_SG and BC_REPLY_SG gather the transaction data from a
+ * list of user buffers instead of one flat buffer.  data.ptr.buffer is
+ * ignored and data_size must equal the sum of the buffer lengths; the
+ * offsets array is relative to the gathered data, as for BC_TRANSACTION.
+ */
+struct binder_sg_entry {
+	const void	*buffer;
+	size_t		length;
+};
+
+struct binder_transaction_data_sg {
+	struct binder_transaction_data	transaction_data;
+	const struct binder_sg_entry	*buffers;
+	size_t				buffers_count;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +342,13 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command, with the data
+	 * gathered from buffers instead of data.ptr.buffer.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
@@ -24,6 +24,10 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/time.h>
+#include <linux/vmalloc.h>
+#include <linux/pagemap.h>
+#include <linux/log2.h>
+#include <linux/capability.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -32,35 +36,65 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Offsets into the log are free running and only reduced modulo the size when
+ * the buffer is accessed.  Writers reserve space at 'w_off' and copy their
+ * payload in without holding any lock; 'c_off' trails behind the oldest entry
+ * still being copied in, and is as far as readers may go.  'head' is the oldest
+ * entry not yet overwritten.  'lock' serializes the updates to the three of
+ * them, readers only ever sample them.
+ *
+ * Everybody who touches the buffer holds 'sem' for reading; it is only taken
+ * for writing to swap in a buffer of a different size.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	struct rw_semaphore	sem;	/* protects buffer and size */
+	spinlock_t		lock;	/* protects the offsets below */
 	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	size_t			c_off;	/* entries before this are complete */
+	size_t			head;	/* oldest entry, new readers start here */
 	size_t			size;	/* size of the log */
+	int			binary;	/* entries are not priority/tag/text */
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by 'mutex'.
+ *
+ * A reader is never told that it has been lapped by the writers; it notices
+ * 'head' has moved past 'r_off' the next time it reads, and skips forward.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
+	struct mutex		mutex;	/* serializes reads on this file */
 	size_t			r_off;	/* current read head offset */
+	struct logger_filter	filter;	/* entries we want to see */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* logger_before - is offset 'a' older than offset 'b'? */
+#define logger_before(a, b)	((long)((a) - (b)) < 0)
+
+/*
+ * The __pad word of each entry's header tracks its state while it is in the
+ * log.  Readers always see it as zero.
+ */
+#define LOGGER_ENTRY_PENDING	0	/* payload is still being copied in */
+#define LOGGER_ENTRY_COMMITTED	1	/* entry can be read */
+#define LOGGER_ENTRY_DISCARDED	2	/* faulted or lapped, readers skip it */
+
+/* bounds for LOGGER_SET_LOG_BUF_SIZE */
+#define LOGGER_LOG_SIZE_MIN	(4 * LOGGER_ENTRY_MAX_LEN)
+#define LOGGER_LOG_SIZE_MAX	(16 * 1024 * 1024)
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -85,37 +119,178 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_len - Grabs the length of the payload of the next entry starting
- * from 'off'.
+ * do_read_log - copies 'count' bytes at offset 'off' of 'log' into 'buf'
+ */
+static void do_read_log(struct logger_log *log, size_t off, void *buf,
+			size_t count)
+{
+	size_t len;
+
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(buf, log->buffer + off, len);
+
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+/*
+ * do_write_log - writes 'count' bytes from 'buf' to offset 'off' of 'log'
+ */
+static void do_write_log(struct logger_log *log, size_t off, const void *buf,
+			 size_t count)
+{
+	size_t len;
+
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
+
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
+}
+
+/*
+ * get_entry_len - Grabs the length of the next entry, header included,
+ * starting from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock, or to check afterwards that 'off' has not
+ * been overwritten in the meantime.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
 	__u16 val;
 
-	switch (log->size - off) {
-	case 1:
-		memcpy(&val, log->buffer + off, 1);
-		memcpy(((char *) &val) + 1, log->buffer, 1);
-		break;
-	default:
-		memcpy(&val, log->buffer + off, 2);
-	}
+	do_read_log(log, off, &val, sizeof(val));
 
 	return sizeof(struct logger_entry) + val;
 }
 
+static __u16 get_entry_state(struct logger_log *log, size_t off)
+{
+	__u16 val;
+
+	do_read_log(log, off + offsetof(struct logger_entry, __pad),
+		    &val, sizeof(val));
+
+	return val;
+}
+
+static void set_entry_state(struct logger_log *log, size_t off, __u16 state)
+{
+	do_write_log(log, off + offsetof(struct logger_entry, __pad),
+		     &state, sizeof(state));
+}
+
+/*
+ * logger_readable - is there anything in the log for 'reader'?
+ */
+static inline int logger_readable(struct logger_log *log,
+				  struct logger_reader *reader)
+{
+	return ACCESS_ONCE(log->c_off) != reader->r_off;
+}
+
+/*
+ * entry_matches - does the entry at 'off' pass the reader's filter?
+ *
+ * Text entries start with a priority byte and a NUL-terminated tag, which is
+ * all we peek at.  The result is only meaningful if the entry has not been
+ * overwritten in the meantime.
+ */
+static int entry_matches(struct logger_log *log, struct logger_reader *reader,
+			 size_t off, struct logger_entry *entry)
+{
+	struct logger_filter *filter = &reader->filter;
+	char peek[LOGGER_FILTER_TAG_LEN + 2];
+	size_t tag_len;
+
+	if (filter->pid && filter->pid != entry->pid)
+		return 0;
+
+	if (log->binary || (!filter->prio && !filter->tag[0]))
+		return 1;
+
+	memset(peek, 0, sizeof(peek));
+	do_read_log(log, off + sizeof(struct logger_entry), peek,
+		    min_t(size_t, entry->len, sizeof(peek)));
+
+	if ((unsigned char)peek[0] < filter->prio)
+		return 0;
+
+	tag_len = strnlen(filter->tag, LOGGER_FILTER_TAG_LEN);
+	if (tag_len && (memcmp(peek + 1, filter->tag, tag_len) ||
+			peek[tag_len + 1] != '\0'))
+		return 0;
+
+	return 1;
+}
+
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * get_next_entry - fetch the header of the next entry for 'reader', skipping
+ * whatever was overwritten, discarded or filtered out since it last read.
  *
- * Caller must hold log->mutex.
+ * Returns 0 with the header in 'entry' and reader->r_off pointing at it, or
+ * -EAGAIN if the reader has caught up with the writers.  The caller must check
+ * with entry_overwritten() once it is done with the entry.
+ *
+ * Caller must hold reader->mutex and log->sem.
+ */
+static int get_next_entry(struct logger_log *log, struct logger_reader *reader,
+			  struct logger_entry *entry)
+{
+	size_t head;
+	int wanted;
+
+	for (;;) {
+		head = ACCESS_ONCE(log->head);
+		if (logger_before(reader->r_off, head))
+			reader->r_off = head;
+
+		if (!logger_readable(log, reader))
+			return -EAGAIN;
+
+		/* pairs with the smp_wmb() in logger_commit() */
+		smp_rmb();
+
+		do_read_log(log, reader->r_off, entry,
+			    sizeof(struct logger_entry));
+		wanted = entry->__pad != LOGGER_ENTRY_DISCARDED &&
+			 entry_matches(log, reader, reader->r_off, entry);
+
+		/* the entry itself may be gone already */
+		smp_rmb();
+		if (logger_before(reader->r_off, ACCESS_ONCE(log->head)))
+			continue;
+
+		if (wanted)
+			break;
+
+		reader->r_off += sizeof(struct logger_entry) + entry->len;
+	}
+
+	entry->__pad = 0;
+	return 0;
+}
+
+/*
+ * entry_overwritten - has a writer started on the entry at 'off' since the
+ * reader sampled it?
+ */
+static inline int entry_overwritten(struct logger_log *log, size_t off)
+{
+	/* pairs with the smp_wmb() in logger_aio_write() */
+	smp_rmb();
+	return logger_before(off, ACCESS_ONCE(log->head));
+}
+
+/*
+ * do_read_log_to_user - reads exactly 'count' bytes of payload at offset
+ * 'off' from 'log' into the user-space buffer 'buf'. Returns 'count' on
+ * success.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static ssize_t do_read_log_to_user(struct logger_log *log, size_t off,
+				   char __user *buf, size_t count)
 {
 	size_t len;
 
@@ -124,8 +299,9 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -136,8 +312,6 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
@@ -152,182 +326,285 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
+ *
+ * No lock is shared with the writers: the entry is copied out and then
+ * thrown away if a writer lapped us while we were at it.
  */
 static ssize_t logger_read(struct file *file, char __user *buf,
 			   size_t count, loff_t *pos)
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry entry;
 	ssize_t ret;
-	DEFINE_WAIT(wait);
 
-start:
-	while (1) {
-		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
+	mutex_lock(&reader->mutex);
+	down_read(&log->sem);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
-		if (!ret)
-			break;
+	while (1) {
+		ret = get_next_entry(log, reader, &entry);
+		if (ret == -EAGAIN) {
+			if (file->f_flags & O_NONBLOCK)
+				break;
+
+			up_read(&log->sem);
+			mutex_unlock(&reader->mutex);
+			ret = wait_event_interruptible(log->wq,
+					logger_readable(log, reader));
+			if (ret)
+				return ret;
+			mutex_lock(&reader->mutex);
+			down_read(&log->sem);
+			continue;
+		}
 
-		if (file->f_flags & O_NONBLOCK) {
-			ret = -EAGAIN;
+		ret = sizeof(struct logger_entry) + entry.len;
+		if (count < ret) {
+			if (entry_overwritten(log, reader->r_off))
+				continue;
+			ret = -EINVAL;
 			break;
 		}
 
-		if (signal_pending(current)) {
-			ret = -EINTR;
+		/* get exactly one entry from the log */
+		if (copy_to_user(buf, &entry, sizeof(struct logger_entry)) ||
+		    do_read_log_to_user(log, reader->r_off +
+					sizeof(struct logger_entry),
+					buf + sizeof(struct logger_entry),
+					entry.len) < 0) {
+			ret = -EFAULT;
 			break;
 		}
 
-		schedule();
+		if (entry_overwritten(log, reader->r_off))
+			continue;
+
+		reader->r_off += ret;
+		break;
 	}
 
-	finish_wait(&log->wq, &wait);
-	if (ret)
-		return ret;
+	up_read(&log->sem);
+	mutex_unlock(&reader->mutex);
 
-	mutex_lock(&log->mutex);
+	return ret;
+}
 
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
-	}
+/*
+ * do_write_log_user - writes 'count' bytes from the user-space buffer 'buf' to
+ * offset 'off' of the log 'log'
+ *
+ * The caller needs to have reserved the space, and to have page faults
+ * disabled: a writer must not sleep while it holds space in the log.
+ *
+ * Returns 'count' on success, negative error code on failure.
+ */
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
+				      const void __user *buf, size_t count)
+{
+	size_t len;
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
-	}
+	if (!access_ok(VERIFY_READ, buf, count))
+		return -EFAULT;
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	if (len && __copy_from_user_inatomic(log->buffer + off, buf, len))
+		return -EFAULT;
 
-out:
-	mutex_unlock(&log->mutex);
+	if (count != len)
+		if (__copy_from_user_inatomic(log->buffer, buf + len,
+					      count - len))
+			return -EFAULT;
 
-	return ret;
+	return count;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_advance_commit - returns the offset of the first entry from 'c_off'
+ * on that is still being copied in, or the write head if there is none.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static size_t logger_advance_commit(struct logger_log *log, size_t c_off)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	while (c_off != log->w_off &&
+	       get_entry_state(log, c_off) != LOGGER_ENTRY_PENDING)
+		c_off += get_entry_len(log, c_off);
 
-	return off;
+	return c_off;
 }
 
 /*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
+ * logger_reserve - reserve 'len' bytes at the write head and fill in the
+ * entry's header, storing its offset in 'off'.  Returns nonzero if the commit
+ * head had to be moved, in which case readers have something new.
+ *
+ * A write always gets its space.  If it is still held by an entry being
+ * copied in, that writer has stalled for a whole buffer's worth of other
+ * writes: its entry is discarded, and logger_commit() tells it so.
+ *
+ * Readers are not touched: they find out that they were lapped on their own.
  */
-static inline int clock_interval(size_t a, size_t b, size_t c)
+static int logger_reserve(struct logger_log *log, struct logger_entry *header,
+			  size_t len, size_t *off)
 {
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+	int lapped = 0;
+
+	spin_lock(&log->lock);
+
+	while (unlikely(log->w_off + len - log->c_off > log->size)) {
+		set_entry_state(log, log->c_off, LOGGER_ENTRY_DISCARDED);
+		smp_wmb();
+		log->c_off = logger_advance_commit(log, log->c_off);
+		lapped = 1;
 	}
 
-	return 0;
+	/* pull the start head past the entries we are about to overwrite */
+	while (log->w_off + len - log->head > log->size)
+		log->head += get_entry_len(log, log->head);
+
+	/* readers must see the new head before the old entries go */
+	smp_wmb();
+
+	*off = log->w_off;
+	log->w_off += len;
+	do_write_log(log, *off, header, sizeof(struct logger_entry));
+
+	spin_unlock(&log->lock);
+
+	return lapped;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * logger_commit - mark the entry at 'off' as done, and move the commit head
+ * past every entry that is.  Returns nonzero if readers have something new.
  *
- * The caller needs to hold log->mutex.
+ * If the commit head is already past 'off', a later writer lapped this one and
+ * the space may belong to somebody else by now, so it is left alone.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static int logger_commit(struct logger_log *log, size_t off, __u16 state)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	size_t c_off, old;
+
+	/* the payload must be visible before the entry is committed */
+	smp_wmb();
+
+	spin_lock(&log->lock);
+
+	old = log->c_off;
+	if (unlikely(logger_before(off, old))) {
+		spin_unlock(&log->lock);
+		return 0;
+	}
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	set_entry_state(log, off, state);
+	c_off = logger_advance_commit(log, old);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	smp_wmb();
+	log->c_off = c_off;
+
+	spin_unlock(&log->lock);
+
+	return c_off != old;
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * logger_write_entry - reserve space for 'header', copy in its payload from
+ * 'iov' and commit it.  Returns the payload length, or -EFAULT if the payload
+ * is not readable without faulting, in which case the entry is discarded.
  *
- * The caller needs to hold log->mutex.
+ * Preemption and page faults are disabled from the reservation to the commit,
+ * so that no writer sits on its space for longer than the copy takes.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static ssize_t logger_write_entry(struct logger_log *log,
+				  struct logger_entry *header,
+				  const struct iovec *iov,
+				  unsigned long nr_segs)
 {
-	size_t len;
+	ssize_t ret = 0;
+	size_t off, pos;
+	int wake;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	preempt_disable();
+	pagefault_disable();
 
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
+	wake = logger_reserve(log, header,
+			      sizeof(struct logger_entry) + header->len, &off);
+
+	pos = off + sizeof(struct logger_entry);
+
+	while (nr_segs-- > 0) {
+		size_t len;
+		ssize_t nr;
+
+		/* figure out how much of this vector we can keep */
+		len = min_t(size_t, iov->iov_len, header->len - ret);
+
+		/* write out this segment's payload */
+		nr = do_write_log_from_user(log, pos, iov->iov_base, len);
+		if (unlikely(nr < 0)) {
+			ret = nr;
+			break;
+		}
+
+		iov++;
+		pos += nr;
+		ret += nr;
+	}
+
+	wake |= logger_commit(log, off, ret < 0 ? LOGGER_ENTRY_DISCARDED :
+						  LOGGER_ENTRY_COMMITTED);
 
-	log->w_off = logger_offset(log->w_off + count);
+	pagefault_enable();
+	preempt_enable();
+
+	/* wake up any blocked readers */
+	if (wake)
+		wake_up_interruptible(&log->wq);
 
+	return ret;
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * logger_fault_in - fault in the part of 'iov' that makes up a payload of
+ * 'count' bytes.  Returns 0 on success, -EFAULT if it is not readable.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static int logger_fault_in(const struct iovec *iov, unsigned long nr_segs,
+			   size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+	for (; nr_segs > 0 && count; nr_segs--, iov++) {
+		len = min_t(size_t, iov->iov_len, count);
+		if (!access_ok(VERIFY_READ, iov->iov_base, len) ||
+		    fault_in_pages_readable(iov->iov_base, len))
 			return -EFAULT;
+		count -= len;
+	}
 
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
+	return 0;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * Only the space reservation and the commit are serialized; concurrent
+ * writers copy their payloads in parallel.  log->sem only keeps the buffer
+ * from being resized underneath us.
+ *
+ * A write to a valid buffer always succeeds.  If the payload is not resident,
+ * the entry is dropped, the pages are faulted in with nothing reserved, and
+ * the write is tried again.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	ssize_t ret;
 
 	now = current_kernel_time();
 
@@ -336,46 +613,23 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = LOGGER_ENTRY_PENDING;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	down_read(&log->sem);
 
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
-		}
-
-		iov++;
-		ret += nr;
+	for (;;) {
+		ret = logger_write_entry(log, &header, iov, nr_segs);
+		if (likely(ret != -EFAULT))
+			break;
+		if (logger_fault_in(iov, nr_segs, header.len))
+			break;
 	}
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	up_read(&log->sem);
 
 	return ret;
 }
@@ -403,17 +657,13 @@ static int logger_open(struct inode *inode, struct file *file)
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader;
 
-		reader = kmalloc(sizeof(struct logger_reader), GFP_KERNEL);
+		reader = kzalloc(sizeof(struct logger_reader), GFP_KERNEL);
 		if (!reader)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_off = ACCESS_ONCE(log->head);
 
 		file->private_data = reader;
 	} else
@@ -431,7 +681,6 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
 		kfree(reader);
 	}
 
@@ -461,36 +710,85 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	if (logger_readable(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_resize - replace the log's buffer with one of 'size' bytes, keeping
+ * as many of the newest entries as fit.
+ *
+ * Offsets are free running, so entries keep their offsets in the new buffer
+ * and readers need no fixing up beyond what they do for being lapped.
+ */
+static int logger_resize(struct logger_log *log, size_t size)
+{
+	unsigned char *buffer, *old;
+	size_t old_size, off, len;
+
+	if (!is_power_of_2(size) || size < LOGGER_LOG_SIZE_MIN ||
+	    size > LOGGER_LOG_SIZE_MAX)
+		return -EINVAL;
+
+	buffer = vmalloc(size);
+	if (!buffer)
+		return -ENOMEM;
+
+	/* shuts out everybody else, so no entry is pending either */
+	down_write(&log->sem);
+
+	while (log->c_off - log->head > size)
+		log->head += get_entry_len(log, log->head);
+
+	old = log->buffer;
+	old_size = log->size;
+	for (off = log->head; off != log->c_off; off += len) {
+		len = min(log->c_off - off, old_size - (off & (old_size - 1)));
+		len = min(len, size - (off & (size - 1)));
+		memcpy(buffer + (off & (size - 1)),
+		       old + (off & (old_size - 1)), len);
+	}
+
+	log->buffer = buffer;
+	log->size = size;
+
+	up_write(&log->sem);
+
+	vfree(old);
+
+	printk(KERN_INFO "logger: resized log '%s' to %luK\n",
+	       log->misc.name, (unsigned long) size >> 10);
+
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_entry entry;
+	size_t c_off;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
-		ret = log->size;
+		ret = ACCESS_ONCE(log->size);
 		break;
 	case LOGGER_GET_LOG_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
 			ret = -EBADF;
 			break;
 		}
+		/* an upper bound, it doesn't take the filter into account */
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		if (logger_before(reader->r_off, ACCESS_ONCE(log->head)))
+			reader->r_off = ACCESS_ONCE(log->head);
+		c_off = ACCESS_ONCE(log->c_off);
+		ret = c_off - reader->r_off;
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -498,25 +796,59 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		mutex_lock(&reader->mutex);
+		down_read(&log->sem);
+		do {
+			ret = get_next_entry(log, reader, &entry);
+			if (ret) {
+				ret = 0;
+				break;
+			}
+			ret = sizeof(struct logger_entry) + entry.len;
+		} while (entry_overwritten(log, reader->r_off));
+		up_read(&log->sem);
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers notice they are behind the head on their next read */
+		down_read(&log->sem);
+		spin_lock(&log->lock);
+		log->head = log->c_off;
+		spin_unlock(&log->lock);
+		up_read(&log->sem);
 		ret = 0;
 		break;
+	case LOGGER_SET_LOG_BUF_SIZE:
+		if (!(file->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		if (!capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		ret = logger_resize(log, arg);
+		break;
+	case LOGGER_SET_FILTER:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		if (copy_from_user(&reader->filter, (void __user *) arg,
+				   sizeof(struct logger_filter)))
+			ret = -EFAULT;
+		else
+			ret = 0;
+		mutex_unlock(&reader->mutex);
+		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -532,14 +864,14 @@ static const struct file_operations logger_fops = {
 };
 
 /*
- * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * Defines a log structure with name 'NAME' and an initial size of 'SIZE'
+ * bytes, which must be a power of two between LOGGER_LOG_SIZE_MIN and
+ * LOGGER_LOG_SIZE_MAX.  The buffer is allocated by init_log().  'BINARY' logs
+ * can only be filtered by pid.
  */
-#define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+#define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE, BINARY) \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
+	.buffer = NULL, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -547,17 +879,19 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.sem = __RWSEM_INITIALIZER(VAR .sem), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.c_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.binary = BINARY, \
 };
 
-DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 64*1024)
-DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, 256*1024)
-DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, 64*1024)
-DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, 64*1024)
+DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 64*1024, 0)
+DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, 256*1024, 1)
+DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, 64*1024, 0)
+DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, 64*1024, 0)
 
 static struct logger_log *get_log_from_minor(int minor)
 {
@@ -576,10 +910,18 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	log->buffer = vmalloc(log->size);
+	if (unlikely(!log->buffer)) {
+		printk(KERN_ERR "logger: failed to allocate buffer "
+		       "for log '%s'!\n", log->misc.name);
+		return -ENOMEM;
+	}
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		vfree(log->buffer);
 		return ret;
 	}
 
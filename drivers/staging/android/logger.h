@@ -39,11 +39,27 @@ struct logger_entry {
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
 
+#define LOGGER_FILTER_TAG_LEN		32
+
+/*
+ * struct logger_filter - the entries read() hands to a reader
+ *
+ * A zero 'pid' or 'prio' and an empty 'tag' match everything.  The priority
+ * and tag are only looked at in the text logs, not in log_events.
+ */
+struct logger_filter {
+	__s32		pid;	/* only this process */
+	__u8		prio;	/* only this priority and above */
+	char		tag[LOGGER_FILTER_TAG_LEN]; /* only this tag */
+};
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_LOG_BUF_SIZE		_IO(__LOGGERIO, 5) /* resize log */
+#define LOGGER_SET_FILTER		_IOW(__LOGGERIO, 6, struct logger_filter)
 
 #endif /* _LINUX_LOGGER_H */
@@ -16,6 +16,12 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * The thresholds are checked when reclaim calls our shrinker, and also as
+ * soon as an allocation finds a zone below its low watermark.  Once a process
+ * has been killed nothing else is killed until it has exited, or for at most
+ * a second.  Every kill and every victim's exit is reported on
+ * /dev/lowmemorykiller, one line each, which can be read and polled.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -31,9 +37,20 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/miscdevice.h>
 #include <linux/mm.h>
+#include <linux/notifier.h>
 #include <linux/oom.h>
+#include <linux/poll.h>
 #include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -57,31 +74,379 @@ static int lowmem_minfree_size = 4;
 			printk(x);			\
 	} while (0)
 
-static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
+/*
+ * Every process is kept in a bucket for its oom_adj, so picking a victim
+ * only looks at processes that may be killed at the current memory level.
+ * Entries are added when a process is forked, moved when its oom_adj is
+ * written and removed when its last thread exits.  They are keyed by the
+ * process's signal_struct and hold a reference on its group leader.
+ */
+struct lowmem_task {
+	struct hlist_node hash_entry;	/* entry in lowmem_task_hash */
+	struct list_head adj_entry;	/* entry in lowmem_adj_buckets */
+	struct signal_struct *sig;	/* the process, for lookup only */
+	struct task_struct *task;	/* its group leader */
+};
+
+#define LOWMEM_HASH_BITS	8
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static struct hlist_head lowmem_task_hash[1 << LOWMEM_HASH_BITS];
+static struct list_head lowmem_adj_buckets[LOWMEM_ADJ_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_index_lock);
+/* set when a process could not be indexed, see lowmem_index_rescan() */
+static int lowmem_index_incomplete;
+
+/*
+ * The last victim, until it exits or LOWMEM_DEATHPENDING_TIMEOUT passes.
+ * Protected by lowmem_index_lock.  The signal_struct is only compared.
+ */
+#define LOWMEM_DEATHPENDING_TIMEOUT	HZ
+
+static struct signal_struct *lowmem_deathpending;
+static pid_t lowmem_deathpending_pid;
+static unsigned long lowmem_deathpending_start;
+static int lowmem_deathpending_size;
+
+/*
+ * Recent kills and victim exits, for /dev/lowmemorykiller.  Readers that
+ * fall more than LOWMEM_EVENTS behind lose the oldest ones.
+ */
+enum {
+	LOWMEM_EVENT_KILL,
+	LOWMEM_EVENT_DEAD,
+};
+
+struct lowmem_event {
+	int type;
+	pid_t pid;
+	int oom_adj;
+	int tasksize;			/* rss, in pages */
+	int other_free;			/* free pages, at kill time */
+	int other_file;			/* file pages, at kill time */
+	unsigned int elapsed_ms;	/* since the kill, at exit time */
+	char comm[TASK_COMM_LEN];
+};
+
+#define LOWMEM_EVENTS	32
+
+static struct lowmem_event lowmem_events[LOWMEM_EVENTS];
+static unsigned long lowmem_event_seq;	/* number of events ever posted */
+static DEFINE_SPINLOCK(lowmem_event_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_event_wait);
+
+static void lowmem_post_event(struct lowmem_event *event)
+{
+	spin_lock(&lowmem_event_lock);
+	lowmem_events[lowmem_event_seq % LOWMEM_EVENTS] = *event;
+	lowmem_event_seq++;
+	spin_unlock(&lowmem_event_lock);
+	wake_up_interruptible(&lowmem_event_wait);
+}
+
+static struct lowmem_task *lowmem_task_find(struct signal_struct *sig)
+{
+	struct lowmem_task *lt;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(lt, node,
+			     &lowmem_task_hash[hash_ptr(sig, LOWMEM_HASH_BITS)],
+			     hash_entry) {
+		if (lt->sig == sig)
+			return lt;
+	}
+	return NULL;
+}
+
+/*
+ * Index @task's process under its current oom_adj, using @new_lt if it is
+ * not indexed yet.  Returns @new_lt if it was not needed.
+ */
+static struct lowmem_task *lowmem_index_update(struct task_struct *task,
+					       struct lowmem_task *new_lt)
+{
+	struct lowmem_task *lt;
+	struct task_struct *leader;
+	struct task_struct *old_leader = NULL;
+	unsigned long flags;
+	int oom_adj;
+
+	spin_lock(&lowmem_index_lock);
+	if (!lock_task_sighand(task, &flags))
+		goto out;
+	/* the exit notification may already have come and gone */
+	if (!atomic_read(&task->signal->live))
+		goto out_unlock_sighand;
+
+	leader = task->group_leader;
+	oom_adj = task->signal->oom_adj;
+	lt = lowmem_task_find(task->signal);
+	if (!lt) {
+		if (!new_lt) {
+			lowmem_print(1, "lowmem: cannot index process %d\n",
+				     leader->pid);
+			lowmem_index_incomplete = 1;
+			goto out_unlock_sighand;
+		}
+		lt = new_lt;
+		new_lt = NULL;
+		lt->sig = task->signal;
+		get_task_struct(leader);
+		lt->task = leader;
+		hlist_add_head(&lt->hash_entry,
+			&lowmem_task_hash[hash_ptr(lt->sig, LOWMEM_HASH_BITS)]);
+		INIT_LIST_HEAD(&lt->adj_entry);
+	} else if (lt->task != leader) {
+		/* a thread other than the leader exec'ed */
+		old_leader = lt->task;
+		get_task_struct(leader);
+		lt->task = leader;
+	}
+	list_move_tail(&lt->adj_entry,
+		       &lowmem_adj_buckets[oom_adj - OOM_DISABLE]);
+
+out_unlock_sighand:
+	unlock_task_sighand(task, &flags);
+out:
+	spin_unlock(&lowmem_index_lock);
+	if (old_leader)
+		put_task_struct(old_leader);
+	return new_lt;
+}
+
+static void lowmem_index_remove(struct task_struct *task)
+{
+	struct lowmem_task *lt;
+	struct lowmem_event event;
+	unsigned long start = 0;
+	int size = 0;
+	int was_pending = 0;
+
+	spin_lock(&lowmem_index_lock);
+	lt = lowmem_task_find(task->signal);
+	if (lt) {
+		hlist_del(&lt->hash_entry);
+		list_del(&lt->adj_entry);
+	}
+	if (lowmem_deathpending == task->signal) {
+		lowmem_deathpending = NULL;
+		start = lowmem_deathpending_start;
+		size = lowmem_deathpending_size;
+		was_pending = 1;
+	}
+	spin_unlock(&lowmem_index_lock);
+
+	if (lt) {
+		put_task_struct(lt->task);
+		kfree(lt);
+	}
+
+	if (was_pending) {
+		memset(&event, 0, sizeof(event));
+		event.type = LOWMEM_EVENT_DEAD;
+		event.pid = task->tgid;
+		event.oom_adj = task->signal->oom_adj;
+		/* the mm is already gone, report what was selected */
+		event.tasksize = size;
+		event.elapsed_ms = jiffies_to_msecs(jiffies - start);
+		get_task_comm(event.comm, task->group_leader);
+		lowmem_print(2, "process %d exited %ums after kill, "
+			     "freeing %d pages\n", event.pid,
+			     event.elapsed_ms, event.tasksize);
+		lowmem_post_event(&event);
+	}
+}
+
+/*
+ * Index every process that is not indexed yet.  Used at init, and again
+ * before picking a victim if an earlier allocation failed, so that a
+ * process is never left out for good.
+ */
+static void lowmem_index_rescan(gfp_t gfp_mask)
 {
 	struct task_struct *p;
-	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
+
+	spin_lock(&lowmem_index_lock);
+	lowmem_index_incomplete = 0;
+	spin_unlock(&lowmem_index_lock);
+
+	rcu_read_lock();
+	for_each_process(p)
+		kfree(lowmem_index_update(p, kmalloc(
+				sizeof(struct lowmem_task), gfp_mask)));
+	rcu_read_unlock();
+}
+
+static int lowmem_oom_adj_notify(struct notifier_block *nb,
+				 unsigned long event, void *data)
+{
+	struct task_struct *task = data;
+
+	if (event == OOM_ADJ_EXIT)
+		lowmem_index_remove(task);
+	else
+		kfree(lowmem_index_update(task, kmalloc(
+				sizeof(struct lowmem_task), GFP_KERNEL)));
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_oom_adj_nb = {
+	.notifier_call = lowmem_oom_adj_notify,
+};
+
+/*
+ * Returns the lowest oom_adj that may be killed at the current level of free
+ * memory, or OOM_ADJUST_MAX + 1 if memory is not low.
+ */
+static int lowmem_min_adj(int *other_free, int *other_file)
+{
 	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
-	int other_free = global_page_state(NR_FREE_PAGES);
-	int other_file = global_page_state(NR_FILE_PAGES);
+
+	*other_free = global_page_state(NR_FREE_PAGES);
+	*other_file = global_page_state(NR_FILE_PAGES);
 
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
+		if (*other_free < lowmem_minfree[i] &&
+		    *other_file < lowmem_minfree[i])
+			return lowmem_adj[i];
+	}
+	return OOM_ADJUST_MAX + 1;
+}
+
+/*
+ * Kill the biggest process in the highest non-empty oom_adj bucket at or
+ * above @min_adj, unless the previous victim is still dying.  Returns the
+ * number of pages it had, or 0 if nothing was killed.
+ */
+static int lowmem_kill(int min_adj, int other_free, int other_file)
+{
+	struct lowmem_task *lt;
+	struct task_struct *selected = NULL;
+	struct lowmem_event event;
+	int selected_tasksize = 0;
+	int selected_oom_adj = 0;
+	int oom_adj;
+
+	if (min_adj < OOM_DISABLE)
+		min_adj = OOM_DISABLE;
+
+	if (lowmem_index_incomplete)
+		lowmem_index_rescan(GFP_NOWAIT);
+
+	spin_lock(&lowmem_index_lock);
+	if (lowmem_deathpending &&
+	    time_before(jiffies, lowmem_deathpending_start +
+				 LOWMEM_DEATHPENDING_TIMEOUT)) {
+		spin_unlock(&lowmem_index_lock);
+		return 0;
+	}
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj && !selected;
+	     oom_adj--) {
+		list_for_each_entry(lt, &lowmem_adj_buckets[oom_adj -
+							     OOM_DISABLE],
+				    adj_entry) {
+			struct task_struct *p = lt->task;
+			int tasksize;
+
+			/* already dying, maybe a timed out earlier victim */
+			if (fatal_signal_pending(p))
+				continue;
+			task_lock(p);
+			if (!p->mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(p->mm);
+			task_unlock(p);
+			if (tasksize <= selected_tasksize)
+				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, oom_adj,
+				     tasksize);
 		}
 	}
+	if (selected) {
+		if (lowmem_deathpending)
+			pr_warning("process %d is suffering a slow death\n",
+				   lowmem_deathpending_pid);
+		get_task_struct(selected);
+		lowmem_deathpending = selected->signal;
+		lowmem_deathpending_pid = selected->pid;
+		lowmem_deathpending_start = jiffies;
+		lowmem_deathpending_size = selected_tasksize;
+	}
+	spin_unlock(&lowmem_index_lock);
+
+	if (!selected)
+		return 0;
+
+	lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
+		     selected->pid, selected->comm,
+		     selected_oom_adj, selected_tasksize);
+	send_sig(SIGKILL, selected, 1);
+
+	memset(&event, 0, sizeof(event));
+	event.type = LOWMEM_EVENT_KILL;
+	event.pid = selected->pid;
+	event.oom_adj = selected_oom_adj;
+	event.tasksize = selected_tasksize;
+	event.other_free = other_free;
+	event.other_file = other_file;
+	get_task_comm(event.comm, selected);
+	lowmem_post_event(&event);
+
+	put_task_struct(selected);
+	return selected_tasksize;
+}
+
+static void lowmem_work_fn(struct work_struct *work)
+{
+	int other_free, other_file;
+	int min_adj = lowmem_min_adj(&other_free, &other_file);
+
+	if (min_adj == OOM_ADJUST_MAX + 1)
+		return;
+	lowmem_print(3, "lowmem_work ofree %d %d, ma %d\n",
+		     other_free, other_file, min_adj);
+	lowmem_kill(min_adj, other_free, other_file);
+}
+
+static DECLARE_WORK(lowmem_work, lowmem_work_fn);
+
+/*
+ * An allocation found a zone below its low watermark.  Check our own
+ * thresholds right away instead of waiting for reclaim to get to the
+ * shrinkers.
+ */
+static int lowmem_kswapd_wakeup(struct notifier_block *nb,
+				unsigned long order, void *data)
+{
+	int other_free, other_file;
+
+	if (lowmem_min_adj(&other_free, &other_file) <= OOM_ADJUST_MAX)
+		schedule_work(&lowmem_work);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_kswapd_nb = {
+	.notifier_call = lowmem_kswapd_wakeup,
+};
+
+static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	int rem = 0;
+	int other_free, other_file;
+	int min_adj = lowmem_min_adj(&other_free, &other_file);
+
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
 			     nr_to_scan, gfp_mask, other_free, other_file,
@@ -95,62 +460,119 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
-
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
+
+	rem -= lowmem_kill(min_adj, other_free, other_file);
+	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
+		     nr_to_scan, gfp_mask, rem);
+	return rem;
+}
+
+static int lowmem_event_open(struct inode *inode, struct file *file)
+{
+	int ret;
+
+	ret = nonseekable_open(inode, file);
+	if (ret)
+		return ret;
+
+	/* only report what happens from now on */
+	spin_lock(&lowmem_event_lock);
+	file->private_data = (void *)lowmem_event_seq;
+	spin_unlock(&lowmem_event_lock);
+	return 0;
+}
+
+static int lowmem_event_format(char *buf, size_t size,
+			       struct lowmem_event *event)
+{
+	if (event->type == LOWMEM_EVENT_KILL)
+		return snprintf(buf, size, "kill %d %s adj %d rss %lukB "
+				"free %lukB file %lukB\n", event->pid,
+				event->comm, event->oom_adj,
+				(unsigned long)event->tasksize << (PAGE_SHIFT - 10),
+				(unsigned long)event->other_free << (PAGE_SHIFT - 10),
+				(unsigned long)event->other_file << (PAGE_SHIFT - 10));
+	return snprintf(buf, size, "dead %d %s adj %d rss %lukB after %ums\n",
+			event->pid, event->comm, event->oom_adj,
+			(unsigned long)event->tasksize << (PAGE_SHIFT - 10),
+			event->elapsed_ms);
+}
+
+/*
+ * lowmem_event_read - returns as many whole event lines as fit in 'count',
+ * blocking for the next one unless O_NONBLOCK is set.  Fails with -EINVAL if
+ * not even one line fits.
+ */
+static ssize_t lowmem_event_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *pos)
+{
+	unsigned long seq = (unsigned long)file->private_data;
+	struct lowmem_event event;
+	char line[128];
+	ssize_t ret = 0;
+	int len;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		ret = wait_event_interruptible(lowmem_event_wait,
+					       seq != lowmem_event_seq);
+		if (ret)
+			return ret;
+	}
+
+	for (;;) {
+		spin_lock(&lowmem_event_lock);
+		if (seq == lowmem_event_seq) {
+			spin_unlock(&lowmem_event_lock);
+			break;
 		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
+		if (lowmem_event_seq - seq > LOWMEM_EVENTS)
+			seq = lowmem_event_seq - LOWMEM_EVENTS;
+		event = lowmem_events[seq % LOWMEM_EVENTS];
+		spin_unlock(&lowmem_event_lock);
+
+		len = lowmem_event_format(line, sizeof(line), &event);
+		if (len > count - ret) {
+			if (!ret)
+				ret = -EINVAL;
+			break;
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
-	if (selected) {
-		if (fatal_signal_pending(selected)) {
-			pr_warning("process %d is suffering a slow death\n",
-				   selected->pid);
-			read_unlock(&tasklist_lock);
-			return rem;
+		if (copy_to_user(buf + ret, line, len)) {
+			ret = -EFAULT;
+			break;
 		}
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
+		ret += len;
+		seq++;
 	}
-	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
-		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
-	return rem;
+	file->private_data = (void *)seq;
+
+	if (ret == 0 && seq == lowmem_event_seq)
+		return -EAGAIN;
+	return ret;
+}
+
+static unsigned int lowmem_event_poll(struct file *file, poll_table *wait)
+{
+	unsigned long seq = (unsigned long)file->private_data;
+
+	poll_wait(file, &lowmem_event_wait, wait);
+	if (seq != lowmem_event_seq)
+		return POLLIN | POLLRDNORM;
+	return 0;
 }
 
+static const struct file_operations lowmem_event_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_event_open,
+	.read = lowmem_event_read,
+	.poll = lowmem_event_poll,
+};
+
+static struct miscdevice lowmem_event_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmemorykiller",
+	.fops = &lowmem_event_fops,
+};
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -158,13 +580,43 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lowmem_task_hash); i++)
+		INIT_HLIST_HEAD(&lowmem_task_hash[i]);
+	for (i = 0; i < ARRAY_SIZE(lowmem_adj_buckets); i++)
+		INIT_LIST_HEAD(&lowmem_adj_buckets[i]);
+
+	/* index whatever is already running, then follow changes */
+	register_oom_adj_notifier(&lowmem_oom_adj_nb);
+	lowmem_index_rescan(GFP_ATOMIC);
+
+	register_kswapd_wakeup_notifier(&lowmem_kswapd_nb);
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_event_misc))
+		printk(KERN_ERR "lowmem: failed to register misc device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct lowmem_task *lt, *tmp;
+	int i;
+
+	misc_deregister(&lowmem_event_misc);
 	unregister_shrinker(&lowmem_shrinker);
+	unregister_kswapd_wakeup_notifier(&lowmem_kswapd_nb);
+	flush_scheduled_work();
+	unregister_oom_adj_notifier(&lowmem_oom_adj_nb);
+
+	for (i = 0; i < ARRAY_SIZE(lowmem_adj_buckets); i++) {
+		list_for_each_entry_safe(lt, tmp, &lowmem_adj_buckets[i],
+					 adj_entry) {
+			list_del(&lt->adj_entry);
+			put_task_struct(lt->task);
+			kfree(lt);
+		}
+	}
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -668,6 +668,20 @@ void mdp_disable_irq(uint32 term);
 void mdp_disable_irq_nosync(uint32 term);
 int mdp_get_bytes_per_pixel(uint32_t format);
 
+#ifdef CONFIG_FB_MSM_MDP_PPP_SW
+extern uint32 mdp_ppp_sw_max_pixels;
+int mdp_ppp_sw_blit(struct mdp_blit_req *req, uint8 *src,
+		    unsigned long src_len, uint8 *dst, unsigned long dst_len);
+#else
+#define mdp_ppp_sw_max_pixels 0
+static inline int mdp_ppp_sw_blit(struct mdp_blit_req *req, uint8 *src,
+				  unsigned long src_len, uint8 *dst,
+				  unsigned long dst_len)
+{
+	return -ENOSYS;
+}
+#endif
+
 #ifdef MDP_HW_VSYNC
 void mdp_hw_vsync_clk_enable(struct msm_fb_data_type *mfd);
 void mdp_hw_vsync_clk_disable(struct msm_fb_data_type *mfd);
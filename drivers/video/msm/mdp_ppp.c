@@ -560,19 +560,24 @@ static void flush_imgs(struct mdp_blit_req *req, int src_bpp, int dst_bpp,
 	get_len(&req->src, &req->src_rect, src_bpp,
 	&src0_len, &src1_len);
 
-	flush_pmem_file(p_src_file,
+	pmem_queue_flush(p_src_file,
 	req->src.offset, src0_len);
 
 	if (IS_PSEUDOPLNR(req->src.format))
-		flush_pmem_file(p_src_file,
+		pmem_queue_flush(p_src_file,
 			req->src.offset + src0_len, src1_len);
 
 	get_len(&req->dst, &req->dst_rect, dst_bpp, &dst0_len, &dst1_len);
-	flush_pmem_file(p_dst_file, req->dst.offset, dst0_len);
+	pmem_queue_flush(p_dst_file, req->dst.offset, dst0_len);
 
 	if (IS_PSEUDOPLNR(req->dst.format))
-		flush_pmem_file(p_dst_file,
+		pmem_queue_flush(p_dst_file,
 			req->dst.offset + dst0_len, dst1_len);
+
+	/* the planes of a buffer are flushed once */
+	pmem_flush_queued(p_src_file);
+	if (p_dst_file != p_src_file)
+		pmem_flush_queued(p_dst_file);
 }
 #else
 static void flush_imgs(struct mdp_blit_req *req, int src_bpp, int dst_bpp,
@@ -1234,16 +1239,13 @@ static int mdp_ppp_verify_req(struct mdp_blit_req *req)
 }
 
 int get_img(struct mdp_img *img, struct fb_info *info, unsigned long *start,
-	    unsigned long *len, struct file **pp_file)
+	    unsigned long *vstart, unsigned long *len, struct file **pp_file)
 {
 	int put_needed, ret = 0;
 	struct file *file;
-#ifdef CONFIG_ANDROID_PMEM
-	unsigned long vstart;
-#endif
 
 #ifdef CONFIG_ANDROID_PMEM
-	if (!get_pmem_file(img->memory_id, start, &vstart, len, pp_file))
+	if (!get_pmem_file(img->memory_id, start, vstart, len, pp_file))
 		return 0;
 #endif
 	file = fget_light(img->memory_id, &put_needed);
@@ -1252,6 +1254,7 @@ int get_img(struct mdp_img *img, struct fb_info *info, unsigned long *start,
 
 	if (MAJOR(file->f_dentry->d_inode->i_rdev) == FB_MAJOR) {
 		*start = info->fix.smem_start;
+		*vstart = (unsigned long)info->screen_base;
 		*len = info->fix.smem_len;
 		*pp_file = file;
 	} else {
@@ -1274,6 +1277,7 @@ void put_img(struct file *p_src_file)
 int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
 {
 	unsigned long src_start, dst_start;
+	unsigned long src_vstart, dst_vstart;
 	unsigned long src_len = 0;
 	unsigned long dst_len = 0;
 	MDPIBUF iBuf;
@@ -1285,13 +1289,15 @@ int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
 		req->dst.format =  mfd->fb_imgType;
 	if (req->src.format == MDP_FB_FORMAT)
 		req->src.format = mfd->fb_imgType;
-	get_img(&req->src, info, &src_start, &src_len, &p_src_file);
+	get_img(&req->src, info, &src_start, &src_vstart, &src_len,
+		&p_src_file);
 	if (src_len == 0) {
 		printk(KERN_ERR "mdp_ppp: could not retrieve image from "
 		       "memory\n");
 		return -1;
 	}
-	get_img(&req->dst, info, &dst_start, &dst_len, &p_dst_file);
+	get_img(&req->dst, info, &dst_start, &dst_vstart, &dst_len,
+		&p_dst_file);
 	if (dst_len == 0) {
 		put_img(p_src_file);
 		printk(KERN_ERR "mdp_ppp: could not retrieve image from "
@@ -1429,6 +1435,25 @@ int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req)
 #endif
 	}
 
+	/*
+	 * Small blits are cheaper on the cpu than a round trip through the
+	 * PPP.  Requests the software blit does not implement still go to
+	 * the hardware, images that overrun their buffer go nowhere.
+	 */
+	if (mdp_ppp_sw_max_pixels &&
+	    req->dst_rect.w * req->dst_rect.h <= mdp_ppp_sw_max_pixels) {
+		int ret = mdp_ppp_sw_blit(req, (uint8 *) src_vstart, src_len,
+					  (uint8 *) dst_vstart, dst_len);
+
+		if (ret == -EFAULT)
+			printk(KERN_ERR "mdp_ppp: image exceeds its buffer!\n");
+		if (!ret || ret == -EFAULT) {
+			put_img(p_src_file);
+			put_img(p_dst_file);
+			return ret;
+		}
+	}
+
 	down(&mdp_ppp_mutex);
 	/* MDP cmd block enable */
 	mdp_pipe_ctrl(MDP_CMD_BLOCK, MDP_BLOCK_POWER_ON, FALSE);
@@ -0,0 +1,741 @@
+/* Copyright (c) 2010, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+/*
+ * Software implementation of the PPP blit.
+ *
+ * Small requests are cheaper to serve on the cpu than to set up the PPP
+ * and wait for its interrupt, and routing all of them here makes it
+ * usable as a reference for the hardware path.
+ * It follows the mdp_blit_req semantics of mdp_ppp_blit(): flips are
+ * applied to the source before the 90 degree clockwise rotation, yuv
+ * sources go through the csc matrix the PPP is programmed with, and
+ * constant, per pixel and color key blending are supported.  Scaling
+ * samples the nearest source pixel and dithering is not applied, so the
+ * output is close to, but not bit exact with, the PPP.  Blur,
+ * sharpening, deinterlacing, premultiplied blending and yuv destinations
+ * are left to the hardware.
+ *
+ * The blending works on packed pixels, two color components per
+ * multiply, which needs nothing beyond the ARMv6 integer pipeline.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fb.h>
+#include <linux/msm_mdp.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#include <asm/cacheflush.h>
+
+#include "mdp.h"
+#include "msm_fb.h"
+
+#define MDP_PPP_SW_MAX_DIM	4096
+
+/*
+ * Blits whose destination rectangle covers at most this many pixels are
+ * done here, 0 leaves everything to the PPP.
+ */
+uint32 mdp_ppp_sw_max_pixels;
+module_param_named(max_pixels, mdp_ppp_sw_max_pixels, uint, 0644);
+
+extern uint32 mdp_plv[];
+
+struct mdp_ppp_sw_csc {
+	int32 matrix[9];
+	int32 bias[3];
+	int32 y_low, y_high, c_low, c_high;
+};
+
+struct mdp_ppp_sw_blit {
+	uint32 src_format;
+	uint32 dst_format;
+	uint8 *src0;		/* rgb or luma plane */
+	uint8 *src1;		/* chroma, pseudo planar and interleaved yuv */
+	uint8 *dst;		/* first pixel of dst_rect */
+	uint32 src0_ystride;
+	uint32 src1_ystride;
+	uint32 dst_ystride;
+	uint32 width;		/* of dst_rect */
+	uint32 height;
+
+	/*
+	 * Byte offset of the source pixel for each dst column and row,
+	 * summed per pixel.  With MDP_ROT_90 the columns walk the source
+	 * vertically and the rows horizontally.
+	 */
+	uint32 *col;
+	uint32 *row;
+	uint32 *ccol;
+	uint32 *crow;
+	uint32 *line;
+
+	uint32 alpha;
+	int blend;
+	int transp;
+	uint32 tp_key;
+	struct mdp_ppp_sw_csc csc;
+};
+
+static int mdp_ppp_sw_src_bpp(uint32 format)
+{
+	switch (format) {
+	case MDP_RGB_565:
+	case MDP_BGR_565:
+	case MDP_YCRYCB_H2V1:
+		return 2;
+	case MDP_RGB_888:
+		return 3;
+	case MDP_XRGB_8888:
+	case MDP_ARGB_8888:
+	case MDP_RGBA_8888:
+	case MDP_BGRA_8888:
+	case MDP_RGBX_8888:
+		return 4;
+	case MDP_Y_CBCR_H2V1:
+	case MDP_Y_CBCR_H2V2:
+	case MDP_Y_CRCB_H2V1:
+	case MDP_Y_CRCB_H2V2:
+		return 1;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int mdp_ppp_sw_dst_bpp(uint32 format)
+{
+	switch (format) {
+	case MDP_RGB_565:
+	case MDP_BGR_565:
+	case MDP_RGB_888:
+	case MDP_XRGB_8888:
+	case MDP_ARGB_8888:
+	case MDP_RGBA_8888:
+	case MDP_BGRA_8888:
+	case MDP_RGBX_8888:
+		return mdp_ppp_sw_src_bpp(format);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int mdp_ppp_sw_is_pseudoplnr(uint32 format)
+{
+	return format == MDP_Y_CBCR_H2V1 || format == MDP_Y_CBCR_H2V2 ||
+		format == MDP_Y_CRCB_H2V1 || format == MDP_Y_CRCB_H2V2;
+}
+
+static int mdp_ppp_sw_has_alpha(uint32 format)
+{
+	return format == MDP_ARGB_8888 || format == MDP_RGBA_8888 ||
+		format == MDP_BGRA_8888;
+}
+
+/* 565 to 888 by replicating the top bits, as the PPP unpacker does */
+static inline uint32 mdp_ppp_sw_565(uint32 p, int bgr)
+{
+	uint32 r = (p >> 11) & 0x1f;
+	uint32 g = (p >> 5) & 0x3f;
+	uint32 b = p & 0x1f;
+
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+	if (bgr)
+		return 0xff000000 | (b << 16) | (g << 8) | r;
+	return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+static inline uint32 mdp_ppp_sw_swap_rb(uint32 p)
+{
+	return (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+}
+
+static inline uint32 mdp_ppp_sw_to_565(uint32 p)
+{
+	return ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x1f);
+}
+
+static void mdp_ppp_sw_init_csc(struct mdp_ppp_sw_csc *csc)
+{
+	int i;
+
+	for (i = 0; i < 9; i++)
+		csc->matrix[i] =
+		    ((int32) (((int32) mdp_ccs_yuv2rgb.ccs[i]) << 20)) >> 20;
+
+	/*
+	 * MDP 3.1 takes the bias as a 9 bit two's complement value added
+	 * to the input, older cores as an 8 bit value subtracted from it.
+	 */
+	for (i = 0; i < 3; i++) {
+		int32 bv = mdp_ccs_yuv2rgb.bv[i];
+
+		if (bv & 0x100)
+			bv = -(((int32) (bv << 23)) >> 23);
+		csc->bias[i] = bv & 0xff;
+	}
+
+	csc->y_low = mdp_plv[0];
+	csc->y_high = mdp_plv[1];
+	csc->c_low = mdp_plv[2];
+	csc->c_high = mdp_plv[3];
+}
+
+static inline uint32 mdp_ppp_sw_clamp8(int32 v)
+{
+	if (v < 0)
+		return 0;
+	if (v > 255)
+		return 255;
+	return v;
+}
+
+/* fixed point equivalent of mdp_conv_matx_yuv2rgb() */
+static inline uint32 mdp_ppp_sw_yuv(const struct mdp_ppp_sw_csc *csc,
+				    int32 y, int32 cb, int32 cr)
+{
+	const int32 *m = csc->matrix;
+	uint32 r, g, b;
+
+	y = clamp(y, csc->y_low, csc->y_high) - csc->bias[0];
+	cb = clamp(cb, csc->c_low, csc->c_high) - csc->bias[1];
+	cr = clamp(cr, csc->c_low, csc->c_high) - csc->bias[2];
+
+	r = mdp_ppp_sw_clamp8((y * m[0] + cb * m[1] + cr * m[2] + 0x100) >> 9);
+	g = mdp_ppp_sw_clamp8((y * m[3] + cb * m[4] + cr * m[5] + 0x100) >> 9);
+	b = mdp_ppp_sw_clamp8((y * m[6] + cb * m[7] + cr * m[8] + 0x100) >> 9);
+
+	return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+/*
+ * Source coordinate of each of n destination pixels along one axis,
+ * sampling the centre of the matching source span.
+ */
+static void mdp_ppp_sw_sample(uint32 *t, uint32 n, uint32 start,
+			      uint32 len, int reverse)
+{
+	uint32 step = (len << 16) / n;
+	uint32 pos = step >> 1;
+	uint32 i;
+
+	for (i = 0; i < n; i++, pos += step)
+		t[reverse ? n - 1 - i : i] = start + (pos >> 16);
+}
+
+static void mdp_ppp_sw_setup_map(struct mdp_ppp_sw_blit *b,
+				 struct mdp_blit_req *req)
+{
+	uint32 *xs, *ys, *cxs, *cys;
+	uint32 nx, ny, i;
+	uint32 bpp = mdp_ppp_sw_src_bpp(req->src.format);
+
+	if (req->flags & MDP_ROT_90) {
+		xs = b->row;
+		cxs = b->crow;
+		nx = b->height;
+		ys = b->col;
+		cys = b->ccol;
+		ny = b->width;
+		mdp_ppp_sw_sample(xs, nx, req->src_rect.x, req->src_rect.w,
+				  req->flags & MDP_FLIP_LR);
+		mdp_ppp_sw_sample(ys, ny, req->src_rect.y, req->src_rect.h,
+				  !(req->flags & MDP_FLIP_UD));
+	} else {
+		xs = b->col;
+		cxs = b->ccol;
+		nx = b->width;
+		ys = b->row;
+		cys = b->crow;
+		ny = b->height;
+		mdp_ppp_sw_sample(xs, nx, req->src_rect.x, req->src_rect.w,
+				  req->flags & MDP_FLIP_LR);
+		mdp_ppp_sw_sample(ys, ny, req->src_rect.y, req->src_rect.h,
+				  req->flags & MDP_FLIP_UD);
+	}
+
+	switch (req->src.format) {
+	case MDP_Y_CBCR_H2V2:
+	case MDP_Y_CRCB_H2V2:
+		for (i = 0; i < nx; i++)
+			cxs[i] = xs[i] & ~1;
+		for (i = 0; i < ny; i++)
+			cys[i] = (ys[i] >> 1) * b->src1_ystride;
+		break;
+	case MDP_Y_CBCR_H2V1:
+	case MDP_Y_CRCB_H2V1:
+		for (i = 0; i < nx; i++)
+			cxs[i] = xs[i] & ~1;
+		for (i = 0; i < ny; i++)
+			cys[i] = ys[i] * b->src1_ystride;
+		break;
+	case MDP_YCRYCB_H2V1:
+		for (i = 0; i < nx; i++)
+			cxs[i] = (xs[i] & ~1) * 2;
+		for (i = 0; i < ny; i++)
+			cys[i] = ys[i] * b->src1_ystride;
+		break;
+	default:
+		break;
+	}
+
+	for (i = 0; i < nx; i++)
+		xs[i] *= bpp;
+	for (i = 0; i < ny; i++)
+		ys[i] *= b->src0_ystride;
+
+	/* the luma of an interleaved pair sits after its chroma byte */
+	if (req->src.format == MDP_YCRYCB_H2V1)
+		for (i = 0; i < nx; i++)
+			xs[i] += 1;
+}
+
+/* unpack one destination row worth of source pixels to argb */
+static void mdp_ppp_sw_fetch(struct mdp_ppp_sw_blit *b, uint32 y)
+{
+	const uint8 *s = b->src0 + b->row[y];
+	const uint8 *c = b->src1 + b->crow[y];
+	const uint32 *col = b->col;
+	const uint32 *ccol = b->ccol;
+	uint32 *line = b->line;
+	uint32 i, n = b->width;
+	const uint8 *p;
+
+	switch (b->src_format) {
+	case MDP_RGB_565:
+	case MDP_BGR_565:
+		for (i = 0; i < n; i++)
+			line[i] = mdp_ppp_sw_565(*(uint16 *) (s + col[i]),
+					b->src_format == MDP_BGR_565);
+		break;
+	case MDP_RGB_888:
+		for (i = 0; i < n; i++) {
+			p = s + col[i];
+			line[i] = 0xff000000 | (p[2] << 16) | (p[1] << 8) |
+				p[0];
+		}
+		break;
+	case MDP_XRGB_8888:
+		for (i = 0; i < n; i++)
+			line[i] = *(uint32 *) (s + col[i]) | 0xff000000;
+		break;
+	case MDP_ARGB_8888:
+	case MDP_BGRA_8888:
+		for (i = 0; i < n; i++)
+			line[i] = *(uint32 *) (s + col[i]);
+		break;
+	case MDP_RGBX_8888:
+		for (i = 0; i < n; i++)
+			line[i] = mdp_ppp_sw_swap_rb(*(uint32 *) (s + col[i]))
+				| 0xff000000;
+		break;
+	case MDP_RGBA_8888:
+		for (i = 0; i < n; i++)
+			line[i] = mdp_ppp_sw_swap_rb(*(uint32 *) (s + col[i]));
+		break;
+	/* Cb is in the MSB of the chroma pair of Y_CBCR, Cr of Y_CRCB */
+	case MDP_Y_CBCR_H2V1:
+	case MDP_Y_CBCR_H2V2:
+		for (i = 0; i < n; i++) {
+			p = c + ccol[i];
+			line[i] = mdp_ppp_sw_yuv(&b->csc, s[col[i]], p[1], p[0]);
+		}
+		break;
+	case MDP_Y_CRCB_H2V1:
+	case MDP_Y_CRCB_H2V2:
+		for (i = 0; i < n; i++) {
+			p = c + ccol[i];
+			line[i] = mdp_ppp_sw_yuv(&b->csc, s[col[i]], p[0], p[1]);
+		}
+		break;
+	case MDP_YCRYCB_H2V1:
+		for (i = 0; i < n; i++) {
+			p = c + ccol[i];
+			line[i] = mdp_ppp_sw_yuv(&b->csc, s[col[i]], p[0], p[2]);
+		}
+		break;
+	}
+}
+
+/*
+ * 0x07e0f81f spreads a 565 pixel over a word with enough headroom
+ * above each component to scale all three by a 5 bit alpha at once.
+ */
+static inline uint32 mdp_ppp_sw_blend_565(uint32 d, uint32 s, uint32 a)
+{
+	d = (d | (d << 16)) & 0x07e0f81f;
+	s = (s | (s << 16)) & 0x07e0f81f;
+	d = ((s * a + d * (32 - a)) >> 5) & 0x07e0f81f;
+	return (d | (d >> 16)) & 0xffff;
+}
+
+/* the same for 8888, two components per multiply with a in 0..256 */
+static inline uint32 mdp_ppp_sw_blend_8888(uint32 d, uint32 s, uint32 a)
+{
+	uint32 ia = 256 - a;
+	uint32 rb, ag;
+
+	rb = (((s & 0x00ff00ff) * a + (d & 0x00ff00ff) * ia) >> 8) &
+		0x00ff00ff;
+	ag = (((s >> 8) & 0x00ff00ff) * a + ((d >> 8) & 0x00ff00ff) * ia) &
+		0xff00ff00;
+	return rb | ag;
+}
+
+/* blending factor of an argb source pixel, 0..255 */
+static inline uint32 mdp_ppp_sw_alpha(struct mdp_ppp_sw_blit *b, uint32 p)
+{
+	uint32 a = p >> 24;
+
+	if (b->transp && (p & 0xffffff) == b->tp_key)
+		return 0;
+	if (b->alpha != MDP_ALPHA_NOP) {
+		a = a * b->alpha + 0x80;
+		a = (a + (a >> 8)) >> 8;
+	}
+	return a;
+}
+
+static void mdp_ppp_sw_store(struct mdp_ppp_sw_blit *b, uint32 y)
+{
+	uint8 *d = b->dst + y * b->dst_ystride;
+	const uint32 *line = b->line;
+	uint32 i, n = b->width;
+	uint32 p, a = 0xff;
+	int swap_rb;
+
+	switch (b->dst_format) {
+	case MDP_RGB_565:
+	case MDP_BGR_565:
+		swap_rb = b->dst_format == MDP_BGR_565;
+		for (i = 0; i < n; i++) {
+			p = line[i];
+			if (b->blend) {
+				a = mdp_ppp_sw_alpha(b, p);
+				if (!a)
+					continue;
+			}
+			if (swap_rb)
+				p = mdp_ppp_sw_swap_rb(p);
+			p = mdp_ppp_sw_to_565(p);
+			if (a != 0xff)
+				p = mdp_ppp_sw_blend_565(((uint16 *) d)[i], p,
+							 (a + 4) >> 3);
+			((uint16 *) d)[i] = p;
+		}
+		break;
+	case MDP_RGB_888:
+		for (i = 0; i < n; i++, d += 3) {
+			p = line[i];
+			if (b->blend) {
+				a = mdp_ppp_sw_alpha(b, p);
+				if (!a)
+					continue;
+			}
+			if (a != 0xff)
+				p = mdp_ppp_sw_blend_8888(d[0] | (d[1] << 8) |
+							  (d[2] << 16), p,
+							  a + (a >> 7));
+			d[0] = p;
+			d[1] = p >> 8;
+			d[2] = p >> 16;
+		}
+		break;
+	default:
+		swap_rb = b->dst_format == MDP_RGBA_8888 ||
+			b->dst_format == MDP_RGBX_8888;
+		for (i = 0; i < n; i++) {
+			p = line[i];
+			if (b->blend) {
+				a = mdp_ppp_sw_alpha(b, p);
+				if (!a)
+					continue;
+				/* opaque where the source covers the dst */
+				p |= 0xff000000;
+			}
+			if (swap_rb)
+				p = mdp_ppp_sw_swap_rb(p);
+			if (a != 0xff)
+				p = mdp_ppp_sw_blend_8888(((uint32 *) d)[i], p,
+							  a + (a >> 7));
+			((uint32 *) d)[i] = p;
+		}
+		break;
+	}
+}
+
+static int mdp_ppp_sw_check(struct mdp_blit_req *req)
+{
+	if (req->flags & (MDP_BLUR | MDP_SHARPENING | MDP_DEINTERLACE |
+			  MDP_BLEND_FG_PREMULT))
+		return -EINVAL;
+	if (mdp_ppp_sw_src_bpp(req->src.format) < 0 ||
+	    mdp_ppp_sw_dst_bpp(req->dst.format) < 0)
+		return -EINVAL;
+	if (req->src_rect.w > MDP_PPP_SW_MAX_DIM ||
+	    req->src_rect.h > MDP_PPP_SW_MAX_DIM ||
+	    req->dst_rect.w > MDP_PPP_SW_MAX_DIM ||
+	    req->dst_rect.h > MDP_PPP_SW_MAX_DIM)
+		return -EINVAL;
+	return 0;
+}
+
+/*
+ * The cpu goes through the kernel mapping of the buffer, so unlike the
+ * PPP it has to stay inside the pmem or fb region the image was looked
+ * up in.  The rectangle is checked again without the 32 bit wrap of
+ * mdp_ppp_verify_req().
+ */
+static int mdp_ppp_sw_fits(struct mdp_img *img, struct mdp_rect *rect,
+			   int bpp, unsigned long len)
+{
+	u64 size = (u64) img->width * img->height * bpp;
+
+	if (rect->x > img->width || rect->w > img->width - rect->x ||
+	    rect->y > img->height || rect->h > img->height - rect->y)
+		return 0;
+
+	if (img->format == MDP_Y_CBCR_H2V2 || img->format == MDP_Y_CRCB_H2V2)
+		size += (u64) img->width * ((img->height + 1) / 2);
+	else if (mdp_ppp_sw_is_pseudoplnr(img->format))
+		size += (u64) img->width * img->height;
+
+	return (u64) img->offset + size <= len;
+}
+
+/*
+ * The kernel mappings may be cached while the PPP and the display
+ * fetch from memory, so the touched lines are written back and dropped
+ * around the cpu access.
+ */
+static void mdp_ppp_sw_flush(uint8 *base, uint32 ystride, uint32 h,
+			     uint32 len)
+{
+	if (h)
+		dmac_flush_range(base, base + (h - 1) * ystride + len);
+}
+
+/*
+ * Blits an already verified request with the cpu.  src and dst are the
+ * kernel addresses of the buffers the images live in, src_len and
+ * dst_len their sizes; req->src.offset and req->dst.offset are applied
+ * here.  Returns -EINVAL for requests it does not implement, which are
+ * then expected to go to the PPP, and -EFAULT for images that do not fit
+ * their buffer.
+ */
+int mdp_ppp_sw_blit(struct mdp_blit_req *req, uint8 *src,
+		    unsigned long src_len, uint8 *dst, unsigned long dst_len)
+{
+	struct mdp_ppp_sw_blit b;
+	uint32 src_y, src_h, y;
+	int dst_bpp;
+
+	if (mdp_ppp_sw_check(req))
+		return -EINVAL;
+	if (!mdp_ppp_sw_fits(&req->src, &req->src_rect,
+			     mdp_ppp_sw_src_bpp(req->src.format), src_len) ||
+	    !mdp_ppp_sw_fits(&req->dst, &req->dst_rect,
+			     mdp_ppp_sw_dst_bpp(req->dst.format), dst_len))
+		return -EFAULT;
+
+	memset(&b, 0, sizeof(b));
+	b.src_format = req->src.format;
+	b.dst_format = req->dst.format;
+	b.width = req->dst_rect.w;
+	b.height = req->dst_rect.h;
+
+	b.src0 = src + req->src.offset;
+	b.src0_ystride = req->src.width * mdp_ppp_sw_src_bpp(b.src_format);
+	b.src1 = b.src0;
+	b.src1_ystride = b.src0_ystride;
+	if (mdp_ppp_sw_is_pseudoplnr(b.src_format))
+		b.src1 = b.src0 + req->src.width * req->src.height;
+
+	dst_bpp = mdp_ppp_sw_dst_bpp(b.dst_format);
+	b.dst_ystride = req->dst.width * dst_bpp;
+	b.dst = dst + req->dst.offset + req->dst_rect.y * b.dst_ystride +
+		req->dst_rect.x * dst_bpp;
+
+	b.col = kmalloc((b.width + b.height) * 2 * sizeof(uint32) +
+			b.width * sizeof(uint32), GFP_KERNEL);
+	if (!b.col)
+		return -ENOMEM;
+	b.ccol = b.col + b.width;
+	b.line = b.ccol + b.width;
+	b.row = b.line + b.width;
+	b.crow = b.row + b.height;
+
+	if (mdp_ppp_sw_is_pseudoplnr(b.src_format) ||
+	    b.src_format == MDP_YCRYCB_H2V1)
+		mdp_ppp_sw_init_csc(&b.csc);
+	mdp_ppp_sw_setup_map(&b, req);
+
+	b.alpha = req->alpha & 0xff;
+	b.transp = req->transp_mask != MDP_TRANSP_NOP;
+	if (b.transp) {
+		if (b.src_format == MDP_RGB_565 || b.src_format == MDP_BGR_565)
+			b.tp_key = mdp_ppp_sw_565(req->transp_mask,
+					b.src_format == MDP_BGR_565) & 0xffffff;
+		else
+			b.tp_key = req->transp_mask & 0xffffff;
+	}
+	b.blend = b.transp || b.alpha != MDP_ALPHA_NOP ||
+		mdp_ppp_sw_has_alpha(b.src_format);
+
+	src_y = req->src_rect.y;
+	src_h = req->src_rect.h;
+	mdp_ppp_sw_flush(b.src0 + src_y * b.src0_ystride, b.src0_ystride,
+			 src_h, b.src0_ystride);
+	if (b.src1 != b.src0) {
+		if (b.src_format == MDP_Y_CBCR_H2V2 ||
+		    b.src_format == MDP_Y_CRCB_H2V2) {
+			src_h = (src_y + src_h + 1) / 2 - src_y / 2;
+			src_y /= 2;
+		}
+		mdp_ppp_sw_flush(b.src1 + src_y * b.src1_ystride,
+				 b.src1_ystride, src_h, b.src1_ystride);
+	}
+	mdp_ppp_sw_flush(b.dst, b.dst_ystride, b.height, b.width * dst_bpp);
+
+	for (y = 0; y < b.height; y++) {
+		mdp_ppp_sw_fetch(&b, y);
+		mdp_ppp_sw_store(&b, y);
+	}
+
+	mdp_ppp_sw_flush(b.dst, b.dst_ystride, b.height, b.width * dst_bpp);
+
+	kfree(b.col);
+	return 0;
+}
+
+#ifdef MSM_FB_ENABLE_DBGFS
+/*
+ * Reading msm_fb/ppp_sw_bench runs compositor shaped blits through the
+ * software path and reports the throughput of each.
+ */
+#define MDP_PPP_SW_BENCH_RUNS	8
+#define MDP_PPP_SW_BENCH_SIZE	(480 * 800 * 4)
+
+static struct {
+	const char *name;
+	uint32 src_format, dst_format;
+	uint32 src_w, src_h, dst_w, dst_h;
+	uint32 flags, alpha;
+} mdp_ppp_sw_bench_shapes[] = {
+	{ "copy 565 480x800", MDP_RGB_565, MDP_RGB_565,
+	  480, 800, 480, 800, 0, MDP_ALPHA_NOP },
+	{ "scale 565 240x400 to 480x800", MDP_RGB_565, MDP_RGB_565,
+	  240, 400, 480, 800, 0, MDP_ALPHA_NOP },
+	{ "blend argb on 565 480x800", MDP_ARGB_8888, MDP_RGB_565,
+	  480, 800, 480, 800, 0, MDP_ALPHA_NOP },
+	{ "fade xrgb 480x800", MDP_XRGB_8888, MDP_XRGB_8888,
+	  480, 800, 480, 800, 0, 0x80 },
+	{ "icon argb on 565 64x64", MDP_ARGB_8888, MDP_RGB_565,
+	  64, 64, 64, 64, 0, MDP_ALPHA_NOP },
+	{ "video h2v2 320x240 to 565 rot90", MDP_Y_CRCB_H2V2, MDP_RGB_565,
+	  320, 240, 480, 800, MDP_ROT_90, MDP_ALPHA_NOP },
+};
+
+static int mdp_ppp_sw_bench_show(struct seq_file *m, void *unused)
+{
+	struct mdp_blit_req req;
+	uint8 *src, *dst;
+	int i, j, ret = 0;
+
+	src = vmalloc(MDP_PPP_SW_BENCH_SIZE);
+	dst = vmalloc(MDP_PPP_SW_BENCH_SIZE);
+	if (!src || !dst) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	for (i = 0; i < MDP_PPP_SW_BENCH_SIZE; i++)
+		src[i] = i * 7 + (i >> 9);
+	memset(dst, 0, MDP_PPP_SW_BENCH_SIZE);
+
+	for (i = 0; i < ARRAY_SIZE(mdp_ppp_sw_bench_shapes); i++) {
+		u64 pixels, us;
+		ktime_t start;
+
+		memset(&req, 0, sizeof(req));
+		req.src.width = mdp_ppp_sw_bench_shapes[i].src_w;
+		req.src.height = mdp_ppp_sw_bench_shapes[i].src_h;
+		req.src.format = mdp_ppp_sw_bench_shapes[i].src_format;
+		req.dst.width = mdp_ppp_sw_bench_shapes[i].dst_w;
+		req.dst.height = mdp_ppp_sw_bench_shapes[i].dst_h;
+		req.dst.format = mdp_ppp_sw_bench_shapes[i].dst_format;
+		req.src_rect.w = req.src.width;
+		req.src_rect.h = req.src.height;
+		req.dst_rect.w = req.dst.width;
+		req.dst_rect.h = req.dst.height;
+		req.alpha = mdp_ppp_sw_bench_shapes[i].alpha;
+		req.transp_mask = MDP_TRANSP_NOP;
+		req.flags = mdp_ppp_sw_bench_shapes[i].flags;
+
+		start = ktime_get();
+		for (j = 0; j < MDP_PPP_SW_BENCH_RUNS; j++) {
+			ret = mdp_ppp_sw_blit(&req, src, MDP_PPP_SW_BENCH_SIZE,
+					      dst, MDP_PPP_SW_BENCH_SIZE);
+			if (ret)
+				goto done;
+		}
+		us = ktime_to_us(ktime_sub(ktime_get(), start)) ? : 1;
+
+		pixels = (u64) req.dst_rect.w * req.dst_rect.h *
+			MDP_PPP_SW_BENCH_RUNS;
+		seq_printf(m, "%-32s %6llu.%02llu MPix/s\n",
+			   mdp_ppp_sw_bench_shapes[i].name,
+			   div64_u64(pixels, us),
+			   div64_u64(pixels * 100, us) % 100);
+	}
+
+done:
+	vfree(src);
+	vfree(dst);
+	return ret;
+}
+
+static int mdp_ppp_sw_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mdp_ppp_sw_bench_show, NULL);
+}
+
+static const struct file_operations mdp_ppp_sw_bench_fops = {
+	.open = mdp_ppp_sw_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init mdp_ppp_sw_init(void)
+{
+	struct dentry *root = msm_fb_get_debugfs_root();
+
+	if (root)
+		debugfs_create_file("ppp_sw_bench", S_IRUSR, root, NULL,
+				    &mdp_ppp_sw_bench_fops);
+	return 0;
+}
+module_init(mdp_ppp_sw_init);
+#endif
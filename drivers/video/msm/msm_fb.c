@@ -2194,8 +2194,11 @@ static int msmfb_blit(struct fb_info *info, void __user *p)
 
 		/*
 		 * Do the blit DMA, if required -- returning early only if
-		 * there is a failure.
+		 * there is a failure.  The cmd block stays powered across
+		 * the window, so the blits don't rearm the MDP power-off
+		 * timer one by one.
 		 */
+		mdp_pipe_ctrl(MDP_CMD_BLOCK, MDP_BLOCK_POWER_ON, FALSE);
 		for (i = 0; i < req_list_count; i++) {
 			if (!(req_list[i].flags & MDP_NO_BLIT)) {
 				/* Do the actual blit. */
@@ -2205,10 +2208,14 @@ static int msmfb_blit(struct fb_info *info, void __user *p)
 				 * Note that early returns don't guarantee
 				 * memory coherency.
 				 */
-				if (ret)
+				if (ret) {
+					mdp_pipe_ctrl(MDP_CMD_BLOCK,
+						MDP_BLOCK_POWER_OFF, FALSE);
 					return ret;
+				}
 			}
 		}
+		mdp_pipe_ctrl(MDP_CMD_BLOCK, MDP_BLOCK_POWER_OFF, FALSE);
 
 		/*
 		 * Ensure that CPU cache and other internal CPU state is
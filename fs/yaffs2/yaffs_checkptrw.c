@@ -242,13 +242,32 @@ static int yaffs_CheckpointFlushBuffer(yaffs_Device *dev)
 }
 
 
+/* Add a run of bytes to the running checksum, the same one byte at a time
+ * sum and xor as always so existing checkpoints still verify.
+ */
+static void yaffs_CheckpointSumBytes(yaffs_Device *dev, const __u8 *data,
+					int nBytes)
+{
+	__u32 sum = dev->checkpointSum;
+	__u32 xor = dev->checkpointXor;
+
+	while (nBytes-- > 0) {
+		sum += *data;
+		xor ^= *data;
+		data++;
+	}
+
+	dev->checkpointSum = sum;
+	dev->checkpointXor = xor;
+}
+
 int yaffs_CheckpointWrite(yaffs_Device *dev, const void *data, int nBytes)
 {
 	int i = 0;
 	int ok = 1;
+	int n;
 
-
-	__u8 * dataBytes = (__u8 *)data;
+	const __u8 *dataBytes = (const __u8 *)data;
 
 
 
@@ -259,14 +278,19 @@ int yaffs_CheckpointWrite(yaffs_Device *dev, const void *data, int nBytes)
 		return -1;
 
 	while (i < nBytes && ok) {
-		dev->checkpointBuffer[dev->checkpointByteOffset] = *dataBytes;
-		dev->checkpointSum += *dataBytes;
-		dev->checkpointXor ^= *dataBytes;
+		/* Copy as much as fits in the current chunk */
+		n = dev->nDataBytesPerChunk - dev->checkpointByteOffset;
+		if (n > nBytes - i)
+			n = nBytes - i;
+
+		memcpy(&dev->checkpointBuffer[dev->checkpointByteOffset],
+			dataBytes, n);
+		yaffs_CheckpointSumBytes(dev, dataBytes, n);
 
-		dev->checkpointByteOffset++;
-		i++;
-		dataBytes++;
-		dev->checkpointByteCount++;
+		dev->checkpointByteOffset += n;
+		i += n;
+		dataBytes += n;
+		dev->checkpointByteCount += n;
 
 
 		if (dev->checkpointByteOffset < 0 ||
@@ -281,6 +305,7 @@ int yaffs_CheckpointRead(yaffs_Device *dev, void *data, int nBytes)
 {
 	int i = 0;
 	int ok = 1;
+	int n;
 	yaffs_ExtendedTags tags;
 
 
@@ -339,13 +364,20 @@ int yaffs_CheckpointRead(yaffs_Device *dev, void *data, int nBytes)
 		}
 
 		if (ok) {
-			*dataBytes = dev->checkpointBuffer[dev->checkpointByteOffset];
-			dev->checkpointSum += *dataBytes;
-			dev->checkpointXor ^= *dataBytes;
-			dev->checkpointByteOffset++;
-			i++;
-			dataBytes++;
-			dev->checkpointByteCount++;
+			/* Take as much as we can from the current chunk */
+			n = dev->nDataBytesPerChunk - dev->checkpointByteOffset;
+			if (n > nBytes - i)
+				n = nBytes - i;
+
+			memcpy(dataBytes,
+				&dev->checkpointBuffer[dev->checkpointByteOffset],
+				n);
+			yaffs_CheckpointSumBytes(dev, dataBytes, n);
+
+			dev->checkpointByteOffset += n;
+			i += n;
+			dataBytes += n;
+			dev->checkpointByteCount += n;
 		}
 	}
 
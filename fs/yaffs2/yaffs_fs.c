@@ -50,6 +50,9 @@ extern const char *yaffs_guts_c_version;
 #include <linux/mtd/mtd.h>
 #include <linux/interrupt.h>
 #include <linux/string.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/suspend.h>
 #include <linux/ctype.h>
 
 #include "asm/div64.h"
@@ -121,16 +124,34 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
+unsigned int yaffs_bg_gc_interval = 500;	/* ms between gc passes, 0 = off */
+unsigned int yaffs_bg_gc_dirty = 50;	/* % of a block that must be garbage */
+unsigned int yaffs_cache_chunks = 10;	/* short op cache chunks per mount */
+unsigned int yaffs_idle_checkpoint = 0;	/* s without writes before a checkpoint, 0 = off */
+unsigned int yaffs_checkpoint_writes = 256;	/* pages written before an idle or suspend checkpoint */
+unsigned int yaffs_checkpoint_interval = 600;	/* min s between idle or suspend checkpoints */
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 module_param(yaffs_traceMask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
+module_param(yaffs_bg_gc_interval, uint, 0644);
+module_param(yaffs_bg_gc_dirty, uint, 0644);
+module_param(yaffs_cache_chunks, uint, 0644);
+module_param(yaffs_idle_checkpoint, uint, 0644);
+module_param(yaffs_checkpoint_writes, uint, 0644);
+module_param(yaffs_checkpoint_interval, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
 MODULE_PARM(yaffs_auto_checkpoint, "i");
+MODULE_PARM(yaffs_bg_gc_interval, "i");
+MODULE_PARM(yaffs_bg_gc_dirty, "i");
+MODULE_PARM(yaffs_cache_chunks, "i");
+MODULE_PARM(yaffs_idle_checkpoint, "i");
+MODULE_PARM(yaffs_checkpoint_writes, "i");
+MODULE_PARM(yaffs_checkpoint_interval, "i");
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25))
@@ -169,6 +190,7 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino);
 		} while(0)
 		
 static void yaffs_put_super(struct super_block *sb);
+static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data);
 
 static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 				loff_t *pos);
@@ -359,23 +381,45 @@ static const struct super_operations yaffs_super_ops = {
 	.put_inode = yaffs_put_inode,
 #endif
 	.put_super = yaffs_put_super,
+	.remount_fs = yaffs_remount_fs,
 	.delete_inode = yaffs_delete_inode,
 	.clear_inode = yaffs_clear_inode,
 	.sync_fs = yaffs_sync_fs,
 	.write_super = yaffs_write_super,
 };
 
+/*
+ * The gross lock serialises everything that goes into yaffs_guts.c.  The
+ * few operations that are known not to change anything in the device take
+ * it shared, so they don't queue up behind each other, only behind writers.
+ */
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_OS, ("yaffs locking %p\n", current));
-	down(&dev->grossLock);
+	down_write(&dev->grossLock);
 	T(YAFFS_TRACE_OS, ("yaffs locked %p\n", current));
 }
 
+static void yaffs_WakeBackgroundGC(yaffs_Device *dev);
+
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_OS, ("yaffs unlocking %p\n", current));
-	up(&dev->grossLock);
+	yaffs_WakeBackgroundGC(dev);
+	up_write(&dev->grossLock);
+}
+
+static void yaffs_GrossLockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_OS, ("yaffs locking shared %p\n", current));
+	down_read(&dev->grossLock);
+	T(YAFFS_TRACE_OS, ("yaffs locked shared %p\n", current));
+}
+
+static void yaffs_GrossUnlockShared(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_OS, ("yaffs unlocking shared %p\n", current));
+	up_read(&dev->grossLock);
 }
 
 
@@ -740,13 +784,24 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
+	/* Plain NAND reads can go side by side, anything else is exclusive */
+	yaffs_GrossLockShared(dev);
 
-	ret = yaffs_ReadDataFromFile(obj, pg_buf,
+	ret = yaffs_ReadDataFromFileConcurrent(obj, pg_buf,
 				pg->index << PAGE_CACHE_SHIFT,
 				PAGE_CACHE_SIZE);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
+
+	if (ret < 0) {
+		yaffs_GrossLock(dev);
+
+		ret = yaffs_ReadDataFromFile(obj, pg_buf,
+					pg->index << PAGE_CACHE_SHIFT,
+					PAGE_CACHE_SIZE);
+
+		yaffs_GrossUnlock(dev);
+	}
 
 	if (ret >= 0)
 		ret = 0;
@@ -1677,7 +1732,8 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf)
 
 	T(YAFFS_TRACE_OS, ("yaffs_statfs\n"));
 
-	yaffs_GrossLock(dev);
+	/* Only reads the block and cache counters */
+	yaffs_GrossLockShared(dev);
 
 	buf->f_type = YAFFS_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
@@ -1726,7 +1782,7 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf)
 	buf->f_ffree = 0;
 	buf->f_bavail = buf->f_bfree;
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossUnlockShared(dev);
 	return 0;
 }
 
@@ -1845,7 +1901,178 @@ static void yaffs_read_inode(struct inode *inode)
 
 static YLIST_HEAD(yaffs_dev_list);
 
-#if 0 /* not used */
+/*
+ * Checkpoints written on idle or on suspend.  Each one costs several blocks,
+ * and yaffs erases it again on the next write, so they are only written
+ * after yaffs_checkpoint_writes pages and at most once every
+ * yaffs_checkpoint_interval seconds.  Returns nonzero if one is owed, with
+ * the earliest time it may be written in *due.
+ */
+static int yaffs_AutoCheckpointDue(yaffs_Device *dev, unsigned long *due)
+{
+	if (!yaffs_auto_checkpoint || dev->isCheckpointed ||
+	    dev->nPageWrites - dev->autoCheckpointPageWrites <
+	    (int)yaffs_checkpoint_writes)
+		return 0;
+
+	*due = dev->autoCheckpointJiffies + yaffs_checkpoint_interval * HZ;
+	return 1;
+}
+
+/* Called with the gross lock held for writing */
+static void yaffs_AutoCheckpoint(yaffs_Device *dev)
+{
+	struct super_block *sb = (struct super_block *)dev->superBlock;
+
+	yaffs_FlushEntireDeviceCache(dev);
+	if (yaffs_CheckpointSave(dev))
+		sb->s_dirt = 0;
+	dev->autoCheckpointPageWrites = dev->nPageWrites;
+	dev->autoCheckpointJiffies = jiffies;
+}
+
+/*
+ * Background garbage collector thread, one per device.
+ *
+ * While there are writes, every yaffs_bg_gc_interval ms it looks for blocks
+ * that are at least yaffs_bg_gc_dirty percent garbage and collects them a few
+ * chunks at a time.  It never waits for the gross lock: if anybody else holds
+ * it the device is not idle and we try again later.  It leaves checkpointed
+ * devices alone so as not to throw away a checkpoint that is still valid.
+ *
+ * Once there is nothing left to do it sleeps until the next write, which is
+ * the only thing that can give it more work, so an idle mount costs no
+ * wakeups.  With yaffs_bg_gc_interval and yaffs_idle_checkpoint both 0 it
+ * is not woken at all.
+ *
+ * Once there is nothing left to collect and nothing has been written for
+ * yaffs_idle_checkpoint seconds it writes a checkpoint, so that a crash or
+ * battery pull doesn't cost a full scan at the next mount.  This is off by
+ * default, and rate limited like the one written on suspend.
+ */
+static int yaffs_BackgroundGC(void *data)
+{
+	yaffs_Device *dev = (yaffs_Device *)data;
+	unsigned dirty;
+	int maxLive;
+	int more;
+	int busy;
+	int pending;
+	int lastPageWrites = -1;
+	unsigned long idleSince = jiffies;
+	unsigned long due = 0;
+	long timeout;
+
+	T(YAFFS_TRACE_GC, ("yaffs_BackgroundGC starting for %s\n", dev->name));
+
+	set_freezable();
+	set_user_nice(current, 10);
+
+	while (!kthread_should_stop()) {
+		try_to_freeze();
+
+		more = 0;
+		busy = 0;
+		dirty = yaffs_bg_gc_dirty;
+		if (yaffs_bg_gc_interval && dirty) {
+			if (down_write_trylock(&dev->grossLock)) {
+				if (dirty > 100)
+					dirty = 100;
+				maxLive = dev->nChunksPerBlock *
+					  (100 - dirty) / 100;
+
+				if (!dev->isCheckpointed)
+					more = yaffs_BackgroundGarbageCollect(
+							dev, maxLive);
+				yaffs_GrossUnlock(dev);
+			} else
+				busy = 1;
+		}
+
+		pending = yaffs_idle_checkpoint &&
+			  yaffs_AutoCheckpointDue(dev, &due);
+		if (pending && time_before(due, idleSince +
+					   yaffs_idle_checkpoint * HZ))
+			due = idleSince + yaffs_idle_checkpoint * HZ;
+
+		if (dev->nPageWrites != lastPageWrites) {
+			lastPageWrites = dev->nPageWrites;
+			idleSince = jiffies;
+		} else if (!more && pending && time_after(jiffies, due) &&
+			   down_write_trylock(&dev->grossLock)) {
+			yaffs_AutoCheckpoint(dev);
+			yaffs_GrossUnlock(dev);
+			/* The save wrote pages, don't go again until the
+			 * next round of writes.
+			 */
+			lastPageWrites = dev->nPageWrites;
+			idleSince = jiffies;
+			pending = 0;
+		}
+
+		if (more) {
+			cond_resched();
+			continue;
+		}
+
+		if (busy)
+			timeout = msecs_to_jiffies(yaffs_bg_gc_interval);
+		else if (pending) {
+			timeout = (long)(due + 1 - jiffies);
+			/* Past it already, the gross lock was busy */
+			if (timeout <= 0)
+				timeout = HZ;
+		} else
+			timeout = MAX_SCHEDULE_TIMEOUT;
+
+		dev->bgGCPageWrites = lastPageWrites;
+		if (wait_event_interruptible_timeout(dev->bgGCWait,
+				dev->nPageWrites != lastPageWrites ||
+				kthread_should_stop(), timeout) > 0 &&
+		    yaffs_bg_gc_interval && !kthread_should_stop())
+			/* Woken by a write, let the writer get on first */
+			schedule_timeout_interruptible(
+				msecs_to_jiffies(yaffs_bg_gc_interval));
+	}
+
+	return 0;
+}
+
+/* Called with the gross lock held for writing */
+static void yaffs_WakeBackgroundGC(yaffs_Device *dev)
+{
+	/* Pairs with the barrier in the gc thread's wait_event */
+	smp_mb();
+	if (dev->bgGCThread && dev->nPageWrites != dev->bgGCPageWrites &&
+	    (yaffs_bg_gc_interval || yaffs_idle_checkpoint) &&
+	    waitqueue_active(&dev->bgGCWait))
+		wake_up(&dev->bgGCWait);
+}
+
+static void yaffs_StartBackgroundGC(yaffs_Device *dev)
+{
+	struct task_struct *tsk;
+
+	init_waitqueue_head(&dev->bgGCWait);
+	dev->bgGCPageWrites = dev->nPageWrites;
+	tsk = kthread_run(yaffs_BackgroundGC, dev, "yaffs-gc-%s", dev->name);
+	if (IS_ERR(tsk)) {
+		T(YAFFS_TRACE_ALWAYS,
+		  ("yaffs: could not start background gc for %s\n",
+		   dev->name));
+		tsk = NULL;
+	}
+	dev->bgGCThread = tsk;
+}
+
+static void yaffs_StopBackgroundGC(yaffs_Device *dev)
+{
+	if (dev->bgGCThread) {
+		kthread_stop(dev->bgGCThread);
+		dev->bgGCThread = NULL;
+	}
+}
+
 static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 {
 	yaffs_Device    *dev = yaffs_SuperToDevice(sb);
@@ -1856,6 +2083,8 @@ static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 		T(YAFFS_TRACE_OS,
 			("yaffs_remount_fs: %s: RO\n", dev->name));
 
+		yaffs_StopBackgroundGC(dev);
+
 		yaffs_GrossLock(dev);
 
 		yaffs_FlushEntireDeviceCache(dev);
@@ -1869,11 +2098,13 @@ static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 	} else {
 		T(YAFFS_TRACE_OS,
 			("yaffs_remount_fs: %s: RW\n", dev->name));
+
+		if (!dev->bgGCThread)
+			yaffs_StartBackgroundGC(dev);
 	}
 
 	return 0;
 }
-#endif
 
 static void yaffs_put_super(struct super_block *sb)
 {
@@ -1881,6 +2112,8 @@ static void yaffs_put_super(struct super_block *sb)
 
 	T(YAFFS_TRACE_OS, ("yaffs_put_super\n"));
 
+	yaffs_StopBackgroundGC(dev);
+
 	yaffs_GrossLock(dev);
 
 	yaffs_FlushEntireDeviceCache(dev);
@@ -1902,6 +2135,11 @@ static void yaffs_put_super(struct super_block *sb)
 		dev->spareBuffer = NULL;
 	}
 
+	if (dev->blockOobBuffer) {
+		YFREE(dev->blockOobBuffer);
+		dev->blockOobBuffer = NULL;
+	}
+
 	kfree(dev);
 }
 
@@ -2187,7 +2425,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	dev->nShortOpCaches = (options.no_cache) ? 0 : yaffs_cache_chunks;
 	dev->inbandTags = options.inband_tags;
 
 	/* ... and the functions. */
@@ -2198,6 +2436,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_ReadChunkWithTagsFromNAND;
 		dev->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		dev->queryNANDBlock = nandmtd2_QueryNANDBlock;
+		dev->readBlockTagsFromNAND = nandmtd2_ReadBlockTagsFromNAND;
 		dev->spareBuffer = YMALLOC(mtd->oobsize);
 		dev->isYaffs2 = 1;
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
@@ -2254,7 +2493,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         YINIT_LIST_HEAD(&dev->searchContexts);
         dev->removeObjectCallback = yaffs_RemoveObjectCallback;
 
-	init_MUTEX(&dev->grossLock);
+	init_rwsem(&dev->grossLock);
 
 	yaffs_GrossLock(dev);
 
@@ -2290,9 +2529,14 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	}
 	sb->s_root = root;
 	sb->s_dirt = !dev->isCheckpointed;
+	dev->autoCheckpointPageWrites = dev->nPageWrites;
+	dev->autoCheckpointJiffies = jiffies;
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs_read_super: isCheckpointed %d\n", dev->isCheckpointed));
 
+	if (!(sb->s_flags & MS_RDONLY))
+		yaffs_StartBackgroundGC(dev);
+
 	T(YAFFS_TRACE_OS, ("yaffs_read_super: done\n"));
 	return sb;
 }
@@ -2394,6 +2638,28 @@ static DECLARE_FSTYPE(yaffs2_fs_type, "yaffs2", yaffs2_read_super,
 
 static struct proc_dir_entry *my_proc_entry;
 
+/* RAM held by a mount, in bytes */
+static char *yaffs_dump_dev_memory(char *buf, yaffs_Device *dev)
+{
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int tnodeBytes = dev->nTnodesCreated * dev->tnodeSize;
+	int objectBytes = dev->nObjectsCreated * sizeof(yaffs_Object);
+	int blockBytes = nBlocks * (sizeof(yaffs_BlockInfo) +
+				    dev->chunkBitmapStride);
+	int cacheBytes = dev->nShortOpCaches * (sizeof(yaffs_ChunkCache) +
+						dev->totalBytesPerChunk);
+
+	buf += sprintf(buf, "tnodeSize.......... %d\n", dev->tnodeSize);
+	buf += sprintf(buf, "tnodeRAM........... %d\n", tnodeBytes);
+	buf += sprintf(buf, "objectRAM.......... %d\n", objectBytes);
+	buf += sprintf(buf, "blockInfoRAM....... %d\n", blockBytes);
+	buf += sprintf(buf, "cacheRAM........... %d\n", cacheBytes);
+	buf += sprintf(buf, "totalRAM........... %d\n",
+		       tnodeBytes + objectBytes + blockBytes + cacheBytes);
+
+	return buf;
+}
+
 static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 {
 	buf += sprintf(buf, "startBlock......... %d\n", dev->startBlock);
@@ -2409,12 +2675,19 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "nFreeTnodes........ %d\n", dev->nFreeTnodes);
 	buf += sprintf(buf, "nObjectsCreated.... %d\n", dev->nObjectsCreated);
 	buf += sprintf(buf, "nFreeObjects....... %d\n", dev->nFreeObjects);
+	buf = yaffs_dump_dev_memory(buf, dev);
 	buf += sprintf(buf, "nFreeChunks........ %d\n", dev->nFreeChunks);
 	buf += sprintf(buf, "nPageWrites........ %d\n", dev->nPageWrites);
 	buf += sprintf(buf, "nPageReads......... %d\n", dev->nPageReads);
 	buf += sprintf(buf, "nBlockErasures..... %d\n", dev->nBlockErasures);
 	buf += sprintf(buf, "nGCCopies.......... %d\n", dev->nGCCopies);
 	buf += sprintf(buf, "garbageCollections. %d\n", dev->garbageCollections);
+	buf += sprintf(buf, "backgroundGCs...... %d\n",
+		       dev->backgroundGarbageCollections);
+	buf += sprintf(buf, "aggressiveGCs...... %d\n",
+		       dev->garbageCollections -
+		       dev->passiveGarbageCollections);
+	buf += sprintf(buf, "nGCBlocks.......... %d\n", dev->nGCBlocks);
 	buf += sprintf(buf, "passiveGCs......... %d\n",
 		    dev->passiveGarbageCollections);
 	buf += sprintf(buf, "nRetriedWrites..... %d\n", dev->nRetriedWrites);
@@ -2425,12 +2698,27 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %d\n", dev->cacheHits);
+	buf += sprintf(buf, "cacheMisses........ %d\n", dev->cacheMisses);
+	buf += sprintf(buf, "cacheEvictions..... %d\n", dev->cacheEvictions);
+	buf += sprintf(buf, "cacheWriteBacks.... %d\n", dev->cacheWriteBacks);
 	buf += sprintf(buf, "nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	buf +=
 	    sprintf(buf, "nBackgroudDeletions %d\n", dev->nBackgroundDeletions);
 	buf += sprintf(buf, "useNANDECC......... %d\n", dev->useNANDECC);
 	buf += sprintf(buf, "isYaffs2........... %d\n", dev->isYaffs2);
+	buf += sprintf(buf, "mountTime.......... %u ms\n", dev->mountTime);
+	buf += sprintf(buf, "nCheckpointSaves... %d\n", dev->nCheckpointSaves);
+	buf += sprintf(buf, "checkpointSave..... %u ms\n",
+		       dev->checkpointSaveTime);
+	buf += sprintf(buf, "checkpointRestore.. %u ms\n",
+		       dev->checkpointRestoreTime);
+	buf += sprintf(buf, "scanBlockState..... %u ms\n",
+		       dev->scanBlockStateTime);
+	buf += sprintf(buf, "scanSort........... %u ms\n", dev->scanSortTime);
+	buf += sprintf(buf, "scanChunks......... %u ms\n", dev->scanChunksTime);
+	buf += sprintf(buf, "nScannedBlocks..... %d\n", dev->nScannedBlocks);
+	buf += sprintf(buf, "nBatchedTagReads... %d\n", dev->nBatchedTagReads);
 	buf += sprintf(buf, "inbandTags......... %d\n", dev->inbandTags);
 
 	return buf;
@@ -2617,6 +2905,86 @@ struct file_system_to_install {
 	int installed;
 };
 
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+/*
+ * Freed tnodes and objects go back to the slab caches, but the pages they
+ * leave empty are only released when a cache is shrunk.  Tell the VM how
+ * much has been freed since the last shrink, and shrink when asked to.
+ */
+static int yaffs_shrink_allocators(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct ylist_head *item;
+	int nFreed = 0;
+
+	/* yaffs allocates with GFP_NOFS, so this can't be yaffs calling */
+	if (!(gfp_mask & __GFP_FS))
+		return nr_to_scan ? -1 : 0;
+
+	/* hold lock_kernel while traversing yaffs_dev_list */
+	lock_kernel();
+	ylist_for_each(item, &yaffs_dev_list) {
+		yaffs_Device *dev = ylist_entry(item, yaffs_Device, devList);
+
+		/* Skip devices being mounted or unmounted */
+		if (!down_read_trylock(&dev->grossLock))
+			continue;
+		if (nr_to_scan)
+			yaffs_ShrinkAllocators(dev);
+		nFreed += dev->nSlabFrees;
+		up_read(&dev->grossLock);
+	}
+	unlock_kernel();
+
+	return nFreed;
+}
+
+static struct shrinker yaffs_shrinker = {
+	.shrink = yaffs_shrink_allocators,
+	.seeks = DEFAULT_SEEKS,
+};
+#endif
+
+/*
+ * Checkpoint writable mounts on the way into suspend. A device that dies
+ * while suspended then mounts from the checkpoint instead of scanning.
+ * Mounts that are busy, or that don't owe one (see yaffs_AutoCheckpointDue),
+ * are skipped so as not to slow down every suspend.
+ */
+static int yaffs_pm_notify(struct notifier_block *nb, unsigned long event,
+			   void *unused)
+{
+	struct ylist_head *item;
+	unsigned long due;
+
+	if (event != PM_SUSPEND_PREPARE || !yaffs_auto_checkpoint)
+		return NOTIFY_DONE;
+
+	/* hold lock_kernel while traversing yaffs_dev_list */
+	lock_kernel();
+	ylist_for_each(item, &yaffs_dev_list) {
+		yaffs_Device *dev = ylist_entry(item, yaffs_Device, devList);
+		struct super_block *sb = (struct super_block *)dev->superBlock;
+
+		if (sb->s_flags & MS_RDONLY)
+			continue;
+
+		/* Busy means not idle, don't hold up the suspend for it */
+		if (!down_write_trylock(&dev->grossLock))
+			continue;
+		if (dev->isMounted && yaffs_AutoCheckpointDue(dev, &due) &&
+		    time_after_eq(jiffies, due))
+			yaffs_AutoCheckpoint(dev);
+		yaffs_GrossUnlock(dev);
+	}
+	unlock_kernel();
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block yaffs_pm_notifier = {
+	.notifier_call = yaffs_pm_notify,
+};
+
 static struct file_system_to_install fs_to_install[] = {
 	{&yaffs_fs_type, 0},
 	{&yaffs2_fs_type, 0},
@@ -2667,6 +3035,13 @@ static int __init init_yaffs_fs(void)
 		}
 	}
 
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+	if (!error)
+		register_shrinker(&yaffs_shrinker);
+#endif
+	if (!error)
+		register_pm_notifier(&yaffs_pm_notifier);
+
 	return error;
 }
 
@@ -2678,6 +3053,11 @@ static void __exit exit_yaffs_fs(void)
 	T(YAFFS_TRACE_ALWAYS, ("yaffs " __DATE__ " " __TIME__
 			       " removing. \n"));
 
+	unregister_pm_notifier(&yaffs_pm_notifier);
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+	unregister_shrinker(&yaffs_shrinker);
+#endif
+
 	remove_proc_entry("yaffs", YPROC_ROOT);
 
 	fsinst = fs_to_install;
@@ -1145,6 +1145,33 @@ static void yaffs_SetObjectName(yaffs_Object *obj, const YCHAR *name)
  * in the tnode.
  */
 
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+
+/* With the slab allocator there is no free list. Each device has its own
+ * cache since the tnode size depends on the tnode width, and a freed tnode
+ * goes straight back to the cache.
+ */
+
+static yaffs_Tnode *yaffs_GetTnodeRaw(yaffs_Device *dev)
+{
+	yaffs_Tnode *tn = NULL;
+
+	if (dev->tnodeCache)
+		tn = kmem_cache_alloc(dev->tnodeCache, GFP_NOFS);
+
+	if (tn)
+		dev->nTnodesCreated++;
+	else
+		T(YAFFS_TRACE_ERROR,
+			(TSTR("yaffs: Could not allocate Tnodes" TENDSTR)));
+
+	dev->nCheckpointBlocksRequired = 0; /* force recalculation*/
+
+	return tn;
+}
+
+#else
+
 /* yaffs_CreateTnodes creates a bunch more tnodes and
  * adds them to the tnode free list.
  * Don't use this function directly
@@ -1163,12 +1190,7 @@ static int yaffs_CreateTnodes(yaffs_Device *dev, int nTnodes)
 	if (nTnodes < 1)
 		return YAFFS_OK;
 
-	/* Calculate the tnode size in bytes for variable width tnode support.
-	 * Must be a multiple of 32-bits  */
-	tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-	if (tnodeSize < sizeof(yaffs_Tnode))
-		tnodeSize = sizeof(yaffs_Tnode);
+	tnodeSize = dev->tnodeSize;
 
 	/* make these things */
 
@@ -1263,16 +1285,14 @@ static yaffs_Tnode *yaffs_GetTnodeRaw(yaffs_Device *dev)
 	return tn;
 }
 
+#endif
+
 static yaffs_Tnode *yaffs_GetTnode(yaffs_Device *dev)
 {
 	yaffs_Tnode *tn = yaffs_GetTnodeRaw(dev);
-	int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-	if (tnodeSize < sizeof(yaffs_Tnode))
-		tnodeSize = sizeof(yaffs_Tnode);
 
 	if (tn)
-		memset(tn, 0, tnodeSize);
+		memset(tn, 0, dev->tnodeSize);
 
 	return tn;
 }
@@ -1280,6 +1300,13 @@ static yaffs_Tnode *yaffs_GetTnode(yaffs_Device *dev)
 /* FreeTnode frees up a tnode and puts it back on the free list */
 static void yaffs_FreeTnode(yaffs_Device *dev, yaffs_Tnode *tn)
 {
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+	if (tn) {
+		kmem_cache_free(dev->tnodeCache, tn);
+		dev->nTnodesCreated--;
+		dev->nSlabFrees++;
+	}
+#else
 	if (tn) {
 #ifdef CONFIG_YAFFS_TNODE_LIST_DEBUG
 		if (tn->internal[YAFFS_NTNODES_INTERNAL] != 0) {
@@ -1293,9 +1320,80 @@ static void yaffs_FreeTnode(yaffs_Device *dev, yaffs_Tnode *tn)
 		dev->freeTnodes = tn;
 		dev->nFreeTnodes++;
 	}
+#endif
 	dev->nCheckpointBlocksRequired = 0; /* force recalculation*/
 }
 
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+
+static void yaffs_FreeTnodeTree(yaffs_Device *dev, yaffs_Tnode *tn, int level)
+{
+	int i;
+
+	if (!tn)
+		return;
+
+	if (level > 0) {
+		for (i = 0; i < YAFFS_NTNODES_INTERNAL; i++)
+			yaffs_FreeTnodeTree(dev, tn->internal[i], level - 1);
+	}
+
+	yaffs_FreeTnode(dev, tn);
+}
+
+/* The cache can only be destroyed once it is empty, so hand back the tnode
+ * trees of all the files still around.
+ */
+static void yaffs_DeinitialiseTnodes(yaffs_Device *dev)
+{
+	struct ylist_head *lh;
+	yaffs_Object *obj;
+	int i;
+
+	if (!dev->tnodeCache)
+		return;
+
+	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
+		ylist_for_each(lh, &dev->objectBucket[i].list) {
+			obj = ylist_entry(lh, yaffs_Object, hashLink);
+			if (obj->variantType == YAFFS_OBJECT_TYPE_FILE) {
+				yaffs_FreeTnodeTree(dev,
+					obj->variant.fileVariant.top,
+					obj->variant.fileVariant.topLevel);
+				obj->variant.fileVariant.top = NULL;
+			}
+		}
+	}
+
+	kmem_cache_destroy(dev->tnodeCache);
+	dev->tnodeCache = NULL;
+}
+
+static int yaffs_InitialiseTnodes(yaffs_Device *dev)
+{
+	dev->nTnodesCreated = 0;
+	dev->nFreeTnodes = 0;
+
+	snprintf(dev->tnodeCacheName, sizeof(dev->tnodeCacheName),
+		 "yaffs_tnode_%s", dev->name ? dev->name : "");
+	dev->tnodeCache = kmem_cache_create(dev->tnodeCacheName,
+					    dev->tnodeSize, 0, 0, NULL);
+
+	return dev->tnodeCache ? YAFFS_OK : YAFFS_FAIL;
+}
+
+/* Give the slab pages left empty by frees back to the system. */
+void yaffs_ShrinkAllocators(yaffs_Device *dev)
+{
+	if (dev->tnodeCache)
+		kmem_cache_shrink(dev->tnodeCache);
+	if (dev->objectCache)
+		kmem_cache_shrink(dev->objectCache);
+	dev->nSlabFrees = 0;
+}
+
+#else
+
 static void yaffs_DeinitialiseTnodes(yaffs_Device *dev)
 {
 	/* Free the list of allocated tnodes */
@@ -1314,14 +1412,18 @@ static void yaffs_DeinitialiseTnodes(yaffs_Device *dev)
 	dev->nFreeTnodes = 0;
 }
 
-static void yaffs_InitialiseTnodes(yaffs_Device *dev)
+static int yaffs_InitialiseTnodes(yaffs_Device *dev)
 {
 	dev->allocatedTnodeList = NULL;
 	dev->freeTnodes = NULL;
 	dev->nFreeTnodes = 0;
 	dev->nTnodesCreated = 0;
+
+	return YAFFS_OK;
 }
 
+#endif
+
 
 void yaffs_PutLevel0Tnode(yaffs_Device *dev, yaffs_Tnode *tn, unsigned pos,
 		unsigned val)
@@ -1843,6 +1945,8 @@ static int yaffs_PruneFileStructure(yaffs_Device *dev,
 
 /*-------------------- End of File Structure functions.-------------------*/
 
+#ifndef CONFIG_YAFFS_SLAB_ALLOCATOR
+
 /* yaffs_CreateFreeObjects creates a bunch more objects and
  * adds them to the object free list.
  */
@@ -1889,6 +1993,8 @@ static int yaffs_CreateFreeObjects(yaffs_Device *dev, int nObjects)
 	return YAFFS_OK;
 }
 
+#endif
+
 
 /* AllocateEmptyObject gets us a clean Object. Tries to make allocate more if we run out */
 static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device *dev)
@@ -1897,6 +2003,11 @@ static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device *dev)
 
 #ifdef VALGRIND_TEST
 	tn = YMALLOC(sizeof(yaffs_Object));
+#elif defined(CONFIG_YAFFS_SLAB_ALLOCATOR)
+	if (dev->objectCache)
+		tn = kmem_cache_alloc(dev->objectCache, GFP_NOFS);
+	if (tn)
+		dev->nObjectsCreated++;
 #else
 	/* If there are none left make more */
 	if (!dev->freeObjects)
@@ -2007,6 +2118,10 @@ static void yaffs_FreeObject(yaffs_Object *tn)
 
 #ifdef VALGRIND_TEST
 	YFREE(tn);
+#elif defined(CONFIG_YAFFS_SLAB_ALLOCATOR)
+	kmem_cache_free(dev->objectCache, tn);
+	dev->nObjectsCreated--;
+	dev->nSlabFrees++;
 #else
 	/* Link into the free list. */
 	tn->siblings.next = (struct ylist_head *)(dev->freeObjects);
@@ -2026,6 +2141,35 @@ void yaffs_HandleDeferedFree(yaffs_Object *obj)
 
 #endif
 
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+
+static void yaffs_DeinitialiseObjects(yaffs_Device *dev)
+{
+	struct ylist_head *lh;
+	struct ylist_head *save;
+	yaffs_Object *obj;
+	int i;
+
+	if (!dev->objectCache)
+		return;
+
+	/* Every object is in the hash table, free them all from there */
+	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
+		ylist_for_each_safe(lh, save, &dev->objectBucket[i].list) {
+			obj = ylist_entry(lh, yaffs_Object, hashLink);
+			ylist_del_init(&obj->hashLink);
+			kmem_cache_free(dev->objectCache, obj);
+		}
+		dev->objectBucket[i].count = 0;
+	}
+
+	kmem_cache_destroy(dev->objectCache);
+	dev->objectCache = NULL;
+	dev->nObjectsCreated = 0;
+}
+
+#else
+
 static void yaffs_DeinitialiseObjects(yaffs_Device *dev)
 {
 	/* Free the list of allocated Objects */
@@ -2044,7 +2188,9 @@ static void yaffs_DeinitialiseObjects(yaffs_Device *dev)
 	dev->nFreeObjects = 0;
 }
 
-static void yaffs_InitialiseObjects(yaffs_Device *dev)
+#endif
+
+static int yaffs_InitialiseObjects(yaffs_Device *dev)
 {
 	int i;
 
@@ -2056,6 +2202,18 @@ static void yaffs_InitialiseObjects(yaffs_Device *dev)
 		YINIT_LIST_HEAD(&dev->objectBucket[i].list);
 		dev->objectBucket[i].count = 0;
 	}
+
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+	dev->nObjectsCreated = 0;
+	snprintf(dev->objectCacheName, sizeof(dev->objectCacheName),
+		 "yaffs_object_%s", dev->name ? dev->name : "");
+	dev->objectCache = kmem_cache_create(dev->objectCacheName,
+					     sizeof(yaffs_Object), 0, 0, NULL);
+	if (!dev->objectCache)
+		return YAFFS_FAIL;
+#endif
+
+	return YAFFS_OK;
 }
 
 static int yaffs_FindNiceObjectBucket(yaffs_Device *dev)
@@ -2845,12 +3003,7 @@ static int yaffs_CalcCheckpointBlocksRequired(yaffs_Device *dev)
 		int nBytes = 0;
 		int nBlocks;
 		int devBlocks = (dev->endBlock - dev->startBlock + 1);
-		int tnodeSize;
-
-		tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-		if (tnodeSize < sizeof(yaffs_Tnode))
-			tnodeSize = sizeof(yaffs_Tnode);
+		int tnodeSize = dev->tnodeSize;
 
 		nBytes += sizeof(yaffs_CheckpointValidity);
 		nBytes += sizeof(yaffs_CheckpointDevice);
@@ -3206,6 +3359,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 	if (bi->blockState != YAFFS_BLOCK_STATE_COLLECTING) {
 		dev->gcBlock = -1;
 		dev->gcChunk = 0;
+		dev->nGCBlocks++;
 	}
 
 	dev->isDoingGC = 0;
@@ -3288,6 +3442,65 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	return aggressive ? gcOk : YAFFS_OK;
 }
 
+/*
+ * Background garbage collection.
+ * Called with nothing else going on in the device, typically from a thread
+ * when the file system is idle, so that writers find erased blocks waiting
+ * for them instead of having to collect blocks themselves.
+ *
+ * Does one leisurely pass, copying at most a few chunks, on the dirtiest
+ * full block that has no more than maxLive chunks in use.
+ * Returns 1 if it did some work and there may be more to do, else 0.
+ */
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int maxLive)
+{
+	int b;
+	int live;
+	int dirtiest = -1;
+	yaffs_BlockInfo *bi;
+
+	if (dev->isDoingGC)
+		return 0;
+
+	/* Keep clear of the reserve, foreground gc needs that */
+	if (dev->nErasedBlocks <= dev->nReservedBlocks)
+		return 0;
+
+	if (dev->gcBlock <= 0) {
+		for (b = dev->internalStartBlock; b <= dev->internalEndBlock; b++) {
+			bi = yaffs_GetBlockInfo(dev, b);
+			live = bi->pagesInUse - bi->softDeletions;
+
+			if (bi->blockState == YAFFS_BLOCK_STATE_FULL &&
+			    live <= maxLive &&
+			    yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
+				dirtiest = b;
+				maxLive = live - 1;
+			}
+		}
+
+		dev->oldestDirtySequence = 0;
+
+		if (dirtiest <= 0)
+			return 0;
+
+		dev->gcBlock = dirtiest;
+		dev->gcChunk = 0;
+	}
+
+	dev->garbageCollections++;
+	dev->passiveGarbageCollections++;
+	dev->backgroundGarbageCollections++;
+
+	T(YAFFS_TRACE_GC,
+	  (TSTR("yaffs: background GC block %d erasedBlocks %d" TENDSTR),
+	   dev->gcBlock, dev->nErasedBlocks));
+
+	yaffs_GarbageCollectBlock(dev, dev->gcBlock, 0);
+
+	return 1;
+}
+
 /*-------------------------  TAGS --------------------------------*/
 
 static int yaffs_TagsMatch(const yaffs_ExtendedTags *tags, int objectId,
@@ -3855,10 +4068,59 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The cache can be a few hundred chunks, so lookups go through a small hash
+ *   on (object, chunk). Grabbing and flushing still walk the whole array, but
+ *   they happen once per chunk of NAND traffic rather than once per access.
  */
 
+static int yaffs_ChunkCacheBucket(const yaffs_Object *obj, int chunkId)
+{
+	return (obj->objectId * 31 + chunkId) & (YAFFS_NCACHE_BUCKETS - 1);
+}
+
+/* Bind a free cache entry to a chunk of an object. */
+static void yaffs_AttachChunkCache(yaffs_ChunkCache *cache, yaffs_Object *obj,
+				int chunkId)
+{
+	yaffs_Device *dev = obj->myDev;
+
+	cache->object = obj;
+	cache->chunkId = chunkId;
+	cache->dirty = 0;
+	cache->locked = 0;
+	cache->nBytes = 0;
+	ylist_add(&cache->hashLink,
+		  &dev->srCacheBucket[yaffs_ChunkCacheBucket(obj, chunkId)]);
+}
+
+/* Throw away whatever the entry holds. */
+static void yaffs_DetachChunkCache(yaffs_ChunkCache *cache)
+{
+	if (cache->object) {
+		ylist_del_init(&cache->hashLink);
+		cache->object = NULL;
+	}
+	cache->dirty = 0;
+}
+
+/* Find a cached chunk without counting it as a hit */
+static yaffs_ChunkCache *yaffs_LookupChunkCache(const yaffs_Object *obj,
+						int chunkId)
+{
+	yaffs_Device *dev = obj->myDev;
+	struct ylist_head *i;
+	yaffs_ChunkCache *cache;
+
+	if (dev->nShortOpCaches > 0) {
+		ylist_for_each(i, &dev->srCacheBucket[yaffs_ChunkCacheBucket(obj, chunkId)]) {
+			cache = ylist_entry(i, yaffs_ChunkCache, hashLink);
+			if (cache->object == obj && cache->chunkId == chunkId)
+				return cache;
+		}
+	}
+	return NULL;
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
@@ -3876,49 +4138,56 @@ static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 	return 0;
 }
 
+static int yaffs_ChunkCacheCompare(const void *a, const void *b)
+{
+	return (*(yaffs_ChunkCache **)a)->chunkId -
+		(*(yaffs_ChunkCache **)b)->chunkId;
+}
 
+/* Write back all the dirty chunks of an object in one batch, in chunk order,
+ * so that they land in consecutive pages of the allocation block.
+ */
 static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
 	int i;
+	int n = 0;
 	yaffs_ChunkCache *cache;
-	int chunkWritten = 0;
+	int chunkWritten = 1;
 	int nCaches = obj->myDev->nShortOpCaches;
 
 	if (nCaches > 0) {
-		do {
-			cache = NULL;
-
-			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
-			}
+		for (i = 0; i < nCaches; i++) {
+			cache = &dev->srCache[i];
+			if (cache->object == obj && cache->dirty &&
+			    !cache->locked)
+				dev->srFlushList[n++] = cache;
+		}
 
-			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+		if (n > 1)
+			yaffs_qsort(dev->srFlushList, n,
+				sizeof(yaffs_ChunkCache *),
+				yaffs_ChunkCacheCompare);
 
-				chunkWritten =
-				    yaffs_WriteChunkDataToObject(cache->object,
-								 cache->chunkId,
-								 cache->data,
-								 cache->nBytes,
-								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
-			}
+		for (i = 0; i < n && chunkWritten > 0; i++) {
+			cache = dev->srFlushList[i];
+
+			/* Writing can't touch the cache, but be careful */
+			if (cache->object != obj || !cache->dirty)
+				continue;
 
-		} while (cache && chunkWritten > 0);
+			/* Write it out and free it up */
+			chunkWritten =
+			    yaffs_WriteChunkDataToObject(cache->object,
+							 cache->chunkId,
+							 cache->data,
+							 cache->nBytes,
+							 1);
+			yaffs_DetachChunkCache(cache);
+			dev->cacheWriteBacks++;
+		}
 
-		if (cache) {
+		if (chunkWritten <= 0) {
 			/* Hoosterman, disk full while writing cache out. */
 			T(YAFFS_TRACE_ERROR,
 			  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
@@ -3958,66 +4227,58 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 }
 
 
-/* Grab us a cache chunk for use.
- * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+/* Grab us a cache chunk for use without writing anything back.
+ * First look for an empty one, then for the least recently used clean one.
+ * Returns NULL if every entry is dirty or locked.
  */
 static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
 {
+	yaffs_ChunkCache *cache = NULL;
 	int i;
 
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
-		}
+	for (i = 0; i < dev->nShortOpCaches; i++) {
+		if (!dev->srCache[i].object)
+			return &dev->srCache[i];
+		if (!dev->srCache[i].dirty && !dev->srCache[i].locked &&
+		    (!cache || dev->srCache[i].lastUse < cache->lastUse))
+			cache = &dev->srCache[i];
 	}
 
-	return NULL;
+	if (cache) {
+		yaffs_DetachChunkCache(cache);
+		dev->cacheEvictions++;
+	}
+
+	return cache;
 }
 
+/* Grab us a cache chunk for use.
+ * If they are all dirty, write back the object owning the least recently
+ * used one and look again.
+ */
 static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
 {
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
+	yaffs_ChunkCache *lru;
 	int i;
-	int pushout;
 
 	if (dev->nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
-
 		cache = yaffs_GrabChunkCacheWorker(dev);
 
 		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
-
 			/* With locking we can't assume we can use entry zero */
-
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+			lru = NULL;
 
 			for (i = 0; i < dev->nShortOpCaches; i++) {
 				if (dev->srCache[i].object &&
 				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
+				    (!lru || dev->srCache[i].lastUse < lru->lastUse))
+					lru = &dev->srCache[i];
 			}
 
-			if (!cache || cache->dirty) {
+			if (lru) {
 				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
+				yaffs_FlushFilesChunkCache(lru->object);
 				cache = yaffs_GrabChunkCacheWorker(dev);
 			}
 
@@ -4031,20 +4292,29 @@ static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
 /* Find a cached chunk */
 static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
+{
+	yaffs_ChunkCache *cache = yaffs_LookupChunkCache(obj, chunkId);
+
+	if (cache)
+		obj->myDev->cacheHits++;
+
+	return cache;
+}
+
+/* Grab a cache chunk for an object and read the chunk into it. */
+static yaffs_ChunkCache *yaffs_FillChunkCache(yaffs_Object *obj, int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
-				dev->cacheHits++;
+	yaffs_ChunkCache *cache;
 
-				return &dev->srCache[i];
-			}
-		}
+	cache = yaffs_GrabChunkCache(dev);
+	if (cache) {
+		yaffs_AttachChunkCache(cache, obj, chunkId);
+		yaffs_ReadChunkDataFromObject(obj, chunkId, cache->data);
+		dev->cacheMisses++;
 	}
-	return NULL;
+
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -4078,10 +4348,10 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 {
 	if (object->myDev->nShortOpCaches > 0) {
-		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
+		yaffs_ChunkCache *cache = yaffs_LookupChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_DetachChunkCache(cache);
 	}
 }
 
@@ -4097,7 +4367,7 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->nShortOpCaches; i++) {
 			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+				yaffs_DetachChunkCache(&dev->srCache[i]);
 		}
 	}
 }
@@ -4314,11 +4584,7 @@ static int yaffs_CheckpointTnodeWorker(yaffs_Object *in, yaffs_Tnode *tn,
 	int i;
 	yaffs_Device *dev = in->myDev;
 	int ok = 1;
-	int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-	if (tnodeSize < sizeof(yaffs_Tnode))
-		tnodeSize = sizeof(yaffs_Tnode);
-
+	int tnodeSize = dev->tnodeSize;
 
 	if (tn) {
 		if (level > 0) {
@@ -4369,10 +4635,7 @@ static int yaffs_ReadCheckpointTnodes(yaffs_Object *obj)
 	yaffs_FileStructure *fileStructPtr = &obj->variant.fileVariant;
 	yaffs_Tnode *tn;
 	int nread = 0;
-	int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
-
-	if (tnodeSize < sizeof(yaffs_Tnode))
-		tnodeSize = sizeof(yaffs_Tnode);
+	int tnodeSize = dev->tnodeSize;
 
 	ok = (yaffs_CheckpointRead(dev, &baseChunk, sizeof(baseChunk)) == sizeof(baseChunk));
 
@@ -4641,8 +4904,13 @@ int yaffs_CheckpointSave(yaffs_Device *dev)
 	yaffs_VerifyFreeChunks(dev);
 
 	if (!dev->isCheckpointed) {
+		__u32 saveStart = Y_TIME_MS();
+
 		yaffs_InvalidateCheckpoint(dev);
-		yaffs_WriteCheckpointData(dev);
+		if (yaffs_WriteCheckpointData(dev)) {
+			dev->nCheckpointSaves++;
+			dev->checkpointSaveTime = Y_TIME_MS() - saveStart;
+		}
 	}
 
 	T(YAFFS_TRACE_ALWAYS, (TSTR("save exit: isCheckpointed %d"TENDSTR), dev->isCheckpointed));
@@ -4714,22 +4982,11 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		 * else bypass the cache.
 		 */
 		if (cache || nToCopy != dev->nDataBytesPerChunk || dev->inbandTags) {
-			if (dev->nShortOpCaches > 0) {
-
-				/* If we can't find the data in the cache, then load it up. */
-
-				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_ReadChunkDataFromObject(in, chunk,
-								      cache->
-								      data);
-					cache->nBytes = 0;
-				}
+			/* If we can't find the data in the cache, then load it up. */
+			if (!cache)
+				cache = yaffs_FillChunkCache(in, chunk);
 
+			if (cache) {
 				yaffs_UseChunkCache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -4770,6 +5027,73 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 	return nDone;
 }
 
+/*
+ * yaffs_ReadDataFromFileConcurrent() is a cut down yaffs_ReadDataFromFile()
+ * that changes nothing in the device, so several threads may be in it at
+ * once as long as nobody is modifying the device meanwhile.
+ *
+ * It only handles whole chunks that are not in the short op cache, and only
+ * where the tnode points straight at the chunk.  Anything else, including a
+ * read that needs ECC correction, makes it return -1, and the caller should
+ * do the read again through yaffs_ReadDataFromFile().
+ */
+int yaffs_ReadDataFromFileConcurrent(yaffs_Object *in, __u8 *buffer,
+				loff_t offset, int nBytes)
+{
+	int chunk;
+	__u32 start;
+	int theChunk;
+	int nDone = 0;
+	yaffs_Tnode *tn;
+
+	yaffs_Device *dev;
+
+	dev = in->myDev;
+
+	if (!dev->isYaffs2 || dev->inbandTags || dev->chunkGroupSize != 1 ||
+	    !dev->readChunkWithTagsFromNAND)
+		return -1;
+
+	while (nDone < nBytes) {
+		yaffs_AddrToChunk(dev, offset, &chunk, &start);
+		chunk++;
+
+		if (start || nBytes - nDone < dev->nDataBytesPerChunk)
+			return -1;
+
+		/* Not yaffs_FindChunkCache(), that bumps the hit count */
+		if (yaffs_LookupChunkCache(in, chunk))
+			return -1;
+
+		theChunk = 0;
+		tn = yaffs_FindLevel0Tnode(dev, &in->variant.fileVariant, chunk);
+		if (tn)
+			theChunk = yaffs_GetChunkGroupBase(dev, tn, chunk);
+
+		if (theChunk > 0 &&
+		    yaffs_CheckChunkBit(dev, theChunk / dev->nChunksPerBlock,
+					theChunk % dev->nChunksPerBlock)) {
+			/* Racy, but it is only a statistic */
+			dev->nPageReads++;
+
+			/* No tags, so nothing goes through dev->spareBuffer */
+			if (dev->readChunkWithTagsFromNAND(dev,
+					theChunk - dev->chunkOffset,
+					buffer, NULL) != YAFFS_OK)
+				return -1;
+		} else {
+			/* get sane (zero) data if you read a hole */
+			memset(buffer, 0, dev->nDataBytesPerChunk);
+		}
+
+		offset += dev->nDataBytesPerChunk;
+		buffer += dev->nDataBytesPerChunk;
+		nDone += dev->nDataBytesPerChunk;
+	}
+
+	return nDone;
+}
+
 int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 			int nBytes, int writeThrough)
 {
@@ -4849,14 +5173,7 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_ReadChunkDataFromObject(in, chunk,
-								      cache->
-								      data);
+					cache = yaffs_FillChunkCache(in, chunk);
 				} else if (cache &&
 					!cache->dirty &&
 					!yaffs_CheckSpaceForAllocation(in->myDev)) {
@@ -6119,12 +6436,18 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	yaffs_BlockIndex *blockIndex = NULL;
 	int altBlockIndex = 0;
 
+	yaffs_ExtendedTags *blockTags = NULL;
+	int haveBlockTags;
+	__u32 phaseStart;
+
 	if (!dev->isYaffs2) {
 		T(YAFFS_TRACE_SCAN,
 		  (TSTR("yaffs_ScanBackwards is only for YAFFS2!" TENDSTR)));
 		return YAFFS_FAIL;
 	}
 
+	phaseStart = Y_TIME_MS();
+
 	T(YAFFS_TRACE_SCAN,
 	  (TSTR
 	   ("yaffs_ScanBackwards starts  intstartblk %d intendblk %d..."
@@ -6148,6 +6471,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	dev->blocksInCheckpoint = 0;
 
+	/* If we can't have this we just read the tags a chunk at a time */
+	if (dev->readBlockTagsFromNAND)
+		blockTags = YMALLOC(dev->nChunksPerBlock *
+				    sizeof(yaffs_ExtendedTags));
+
 	chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 	/* Scan all the blocks to determine their state */
@@ -6210,7 +6538,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	T(YAFFS_TRACE_SCAN,
 	(TSTR("%d blocks to be sorted..." TENDSTR), nBlocksToScan));
 
-
+	dev->scanBlockStateTime = Y_TIME_MS() - phaseStart;
+	phaseStart = Y_TIME_MS();
 
 	YYIELD();
 
@@ -6240,6 +6569,9 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	YYIELD();
 
+	dev->scanSortTime = Y_TIME_MS() - phaseStart;
+	phaseStart = Y_TIME_MS();
+
 	T(YAFFS_TRACE_SCAN, (TSTR("...done" TENDSTR)));
 
 	/* Now scan the blocks looking at the data. */
@@ -6265,6 +6597,16 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		dev->nScannedBlocks++;
+		haveBlockTags = 0;
+		if (blockTags &&
+		    (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING ||
+		     state == YAFFS_BLOCK_STATE_ALLOCATING) &&
+		    yaffs_ReadBlockTagsFromNAND(dev, blk, blockTags) == YAFFS_OK) {
+			haveBlockTags = 1;
+			dev->nBatchedTagReads++;
+		}
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->nChunksPerBlock - 1;
@@ -6277,8 +6619,12 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			if (haveBlockTags) {
+				tags = blockTags[c];
+				result = YAFFS_OK;
+			} else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev,
+							chunk, NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -6732,6 +7078,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	else
 		YFREE(blockIndex);
 
+	if (blockTags)
+		YFREE(blockTags);
+
+	dev->scanChunksTime = Y_TIME_MS() - phaseStart;
+
 	/* Ok, we've done all the scanning.
 	 * Fix up the hard link chains.
 	 * We should now have scanned all the objects, now it's time to add these
@@ -7291,6 +7642,7 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	int init_failed = 0;
 	unsigned x;
 	int bits;
+	__u32 mountStart = Y_TIME_MS();
 
 	T(YAFFS_TRACE_TRACING, (TSTR("yaffs: yaffs_GutsInitialise()" TENDSTR)));
 
@@ -7408,6 +7760,12 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 
 	dev->tnodeMask = (1<<dev->tnodeWidth)-1;
 
+	/* Calculate the tnode size in bytes for variable width tnode support.
+	 * Must be a multiple of 32-bits  */
+	dev->tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
+	if (dev->tnodeSize < sizeof(yaffs_Tnode))
+		dev->tnodeSize = sizeof(yaffs_Tnode);
+
 	/* Level0 Tnodes are 16 bits or wider (if wide tnodes are enabled),
 	 * so if the bitwidth of the
 	 * chunk range we're using is greater than 16 we need
@@ -7438,6 +7796,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	/* More device initialisation */
 	dev->garbageCollections = 0;
 	dev->passiveGarbageCollections = 0;
+	dev->backgroundGarbageCollections = 0;
+	dev->nGCBlocks = 0;
 	dev->currentDirtyChecker = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
@@ -7458,18 +7818,29 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	dev->srFlushList = NULL;
 	dev->gcCleanupList = NULL;
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+	dev->tnodeCache = NULL;
+	dev->objectCache = NULL;
+	dev->nSlabFrees = 0;
+#endif
+
+	for (x = 0; x < YAFFS_NCACHE_BUCKETS; x++)
+		YINIT_LIST_HEAD(&dev->srCacheBucket[x]);
 
 
 	if (!init_failed &&
 	    dev->nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+
 		dev->srCache =  YMALLOC(srCacheBytes);
 
 		buf = (__u8 *) dev->srCache;
@@ -7479,6 +7850,7 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 
 		for (i = 0; i < dev->nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
+			YINIT_LIST_HEAD(&dev->srCache[i].hashLink);
 			dev->srCache[i].lastUse = 0;
 			dev->srCache[i].dirty = 0;
 			dev->srCache[i].data = buf = YMALLOC_DMA(dev->totalBytesPerChunk);
@@ -7487,9 +7859,27 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 			init_failed = 1;
 
 		dev->srLastUse = 0;
+
+		dev->srFlushList = YMALLOC(dev->nShortOpCaches *
+					   sizeof(yaffs_ChunkCache *));
+		if (!dev->srFlushList)
+			init_failed = 1;
 	}
 
+
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
+	dev->cacheEvictions = 0;
+	dev->cacheWriteBacks = 0;
+
+	dev->checkpointRestoreTime = 0;
+	dev->checkpointSaveTime = 0;
+	dev->nCheckpointSaves = 0;
+	dev->scanBlockStateTime = 0;
+	dev->scanSortTime = 0;
+	dev->scanChunksTime = 0;
+	dev->nScannedBlocks = 0;
+	dev->nBatchedTagReads = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->nChunksPerBlock * sizeof(__u32));
@@ -7503,8 +7893,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	if (!init_failed && !yaffs_InitialiseBlocks(dev))
 		init_failed = 1;
 
-	yaffs_InitialiseTnodes(dev);
-	yaffs_InitialiseObjects(dev);
+	if (!yaffs_InitialiseTnodes(dev) || !yaffs_InitialiseObjects(dev))
+		init_failed = 1;
 
 	if (!init_failed && !yaffs_CreateInitialDirectories(dev))
 		init_failed = 1;
@@ -7513,7 +7903,12 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	if (!init_failed) {
 		/* Now scan the flash. */
 		if (dev->isYaffs2) {
-			if (yaffs_CheckpointRestore(dev)) {
+			__u32 restoreStart = Y_TIME_MS();
+			int restored = yaffs_CheckpointRestore(dev);
+
+			dev->checkpointRestoreTime = Y_TIME_MS() - restoreStart;
+
+			if (restored) {
 				yaffs_CheckObjectDetailsLoaded(dev->rootDir);
 				T(YAFFS_TRACE_ALWAYS,
 				  (TSTR("yaffs: restored from checkpoint" TENDSTR)));
@@ -7539,8 +7934,9 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 				if (!init_failed && !yaffs_InitialiseBlocks(dev))
 					init_failed = 1;
 
-				yaffs_InitialiseTnodes(dev);
-				yaffs_InitialiseObjects(dev);
+				if (!yaffs_InitialiseTnodes(dev) ||
+				    !yaffs_InitialiseObjects(dev))
+					init_failed = 1;
 
 				if (!init_failed && !yaffs_CreateInitialDirectories(dev))
 					init_failed = 1;
@@ -7582,6 +7978,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	if (!dev->isCheckpointed && dev->blocksInCheckpoint > 0)
 		yaffs_InvalidateCheckpoint(dev);
 
+	dev->mountTime = Y_TIME_MS() - mountStart;
+
 	T(YAFFS_TRACE_TRACING,
 	  (TSTR("yaffs: yaffs_GutsInitialise() done.\n" TENDSTR)));
 	return YAFFS_OK;
@@ -7609,6 +8007,11 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 			dev->srCache = NULL;
 		}
 
+		if (dev->srFlushList) {
+			YFREE(dev->srFlushList);
+			dev->srFlushList = NULL;
+		}
+
 		YFREE(dev->gcCleanupList);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
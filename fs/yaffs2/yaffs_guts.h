@@ -88,7 +88,8 @@
 
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	512
+#define YAFFS_NCACHE_BUCKETS		64	/* Must be a power of 2 */
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -115,6 +116,7 @@
 typedef struct {
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
+	struct ylist_head hashLink;	/* In srCacheBucket[] while object is set */
 	int lastUse;
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
@@ -553,7 +555,8 @@ struct yaffs_DeviceStruct {
 
 
 	int nShortOpCaches;	/* If <= 0, then short op caching is disabled, else
-				 * the number of short op caches (don't use too many)
+				 * the number of short op caches (up to
+				 * YAFFS_MAX_SHORT_OP_CACHES)
 				 */
 
 	int useHeaderFileSize;	/* Flag to determine if we should use file sizes from the header */
@@ -590,6 +593,9 @@ struct yaffs_DeviceStruct {
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct *dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct *dev, int blockNo,
 			       yaffs_BlockState *state, __u32 *sequenceNumber);
+	/* Optional: the tags of every chunk in a block in one go, for scanning */
+	int (*readBlockTagsFromNAND) (struct yaffs_DeviceStruct *dev,
+				      int blockNo, yaffs_ExtendedTags *tags);
 #endif
 
 	int isYaffs2;
@@ -623,6 +629,7 @@ struct yaffs_DeviceStruct {
 	/* Stuff to support wide tnodes */
 	__u32 tnodeWidth;
 	__u32 tnodeMask;
+	__u32 tnodeSize;	/* Bytes per tnode, a multiple of 32 bits */
 
 	/* Stuff for figuring out file offset to chunk conversions */
 	__u32 chunkShift; /* Shift value */
@@ -636,11 +643,20 @@ struct yaffs_DeviceStruct {
 #ifdef __KERNEL__
 
 	struct semaphore sem;	/* Semaphore for waiting on erasure.*/
-	struct semaphore grossLock;	/* Gross locking semaphore */
+	struct rw_semaphore grossLock;	/* Gross locking semaphore */
+	struct task_struct *bgGCThread;	/* Background garbage collector */
+	wait_queue_head_t bgGCWait;	/* It sleeps here while idle */
+	int bgGCPageWrites;	/* nPageWrites when it went to sleep */
+	int autoCheckpointPageWrites;	/* nPageWrites after the last idle or
+					 * suspend checkpoint */
+	unsigned long autoCheckpointJiffies;	/* and when it was written */
 	struct rw_semaphore dirLock; /* Lock the directory structure */
 	__u8 *spareBuffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 
+				 */
+	__u8 *blockOobBuffer;	/* For mtdif2 use, the oob of a whole block,
+				 * allocated on first use.
 				 */
 	void (*putSuperFunc) (struct super_block *sb);
         struct ylist_head searchContexts;
@@ -691,7 +707,7 @@ struct yaffs_DeviceStruct {
 	int allocationBlockFinder;	/* Used to search for next allocation block */
 
 	/* Runtime state */
-	int nTnodesCreated;
+	int nTnodesCreated;	/* With the slab allocator, the live count */
 	yaffs_Tnode *freeTnodes;
 	int nFreeTnodes;
 	yaffs_TnodeList *allocatedTnodeList;
@@ -708,6 +724,14 @@ struct yaffs_DeviceStruct {
 
 	yaffs_ObjectList *allocatedObjectList;
 
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+	struct kmem_cache *tnodeCache;
+	struct kmem_cache *objectCache;
+	char tnodeCacheName[32];
+	char objectCacheName[32];
+	int nSlabFrees;		/* Frees since the caches were last shrunk */
+#endif
+
 	yaffs_ObjectBucket objectBucket[YAFFS_NOBJECT_BUCKETS];
 
 	int nFreeChunks;
@@ -725,6 +749,8 @@ struct yaffs_DeviceStruct {
 	int nGCCopies;
 	int garbageCollections;
 	int passiveGarbageCollections;
+	int backgroundGarbageCollections;
+	int nGCBlocks;		/* blocks completely collected */
 	int nRetriedWrites;
 	int nRetiredBlocks;
 	int eccFixed;
@@ -736,6 +762,17 @@ struct yaffs_DeviceStruct {
 
 	int hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 
+	/* Mount statistics, times in ms */
+	__u32 mountTime;
+	__u32 checkpointRestoreTime;
+	__u32 scanBlockStateTime;
+	__u32 scanSortTime;
+	__u32 scanChunksTime;
+	__u32 checkpointSaveTime;	/* Last checkpoint written */
+	int nCheckpointSaves;
+	int nScannedBlocks;
+	int nBatchedTagReads;	/* blocks whose tags came from one read */
+
 	/* Special directories */
 	yaffs_Object *rootDir;
 	yaffs_Object *lostNFoundDir;
@@ -750,8 +787,13 @@ struct yaffs_DeviceStruct {
 
 	yaffs_ChunkCache *srCache;
 	int srLastUse;
+	struct ylist_head srCacheBucket[YAFFS_NCACHE_BUCKETS];
+	yaffs_ChunkCache **srFlushList;	/* Scratch for sorting a write-back */
 
 	int cacheHits;
+	int cacheMisses;
+	int cacheEvictions;
+	int cacheWriteBacks;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -842,6 +884,9 @@ int yaffs_GetAttributes(yaffs_Object *obj, struct iattr *attr);
 /* File operations */
 int yaffs_ReadDataFromFile(yaffs_Object *obj, __u8 *buffer, loff_t offset,
 				int nBytes);
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int maxLive);
+int yaffs_ReadDataFromFileConcurrent(yaffs_Object *obj, __u8 *buffer,
+				loff_t offset, int nBytes);
 int yaffs_WriteDataToFile(yaffs_Object *obj, const __u8 *buffer, loff_t offset,
 				int nBytes, int writeThrough);
 int yaffs_ResizeFile(yaffs_Object *obj, loff_t newSize);
@@ -856,6 +901,10 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev);
 int yaffs_CheckpointSave(yaffs_Device *dev);
 int yaffs_CheckpointRestore(yaffs_Device *dev);
 
+#ifdef CONFIG_YAFFS_SLAB_ALLOCATOR
+void yaffs_ShrinkAllocators(yaffs_Device *dev);
+#endif
+
 /* Directory operations */
 yaffs_Object *yaffs_MknodDirectory(yaffs_Object *parent, const YCHAR *name,
 				__u32 mode, __u32 uid, __u32 gid);
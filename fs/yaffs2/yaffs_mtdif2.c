@@ -187,6 +187,56 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		return YAFFS_FAIL;
 }
 
+int nandmtd2_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockNo,
+				   yaffs_ExtendedTags *tags)
+{
+#if (MTD_VERSION_CODE > MTD_VERSION(2, 6, 17))
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	struct mtd_oob_ops ops;
+	yaffs_PackedTags2 pt;
+	__u8 *oob;
+	int retval;
+	int i;
+
+	loff_t addr = ((loff_t) blockNo) * dev->nChunksPerBlock *
+			dev->totalBytesPerChunk;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadBlockTagsFromNAND block %d" TENDSTR), blockNo));
+
+	if (dev->inbandTags || mtd->oobavail < sizeof(pt))
+		return YAFFS_FAIL;
+
+	/* Kept for the life of the mount, this is called for every block */
+	if (!dev->blockOobBuffer)
+		dev->blockOobBuffer = YMALLOC(dev->nChunksPerBlock *
+					      mtd->oobavail);
+	oob = dev->blockOobBuffer;
+	if (!oob)
+		return YAFFS_FAIL;
+
+	/* The auto layout gives us oobavail bytes for each page in turn */
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooblen = dev->nChunksPerBlock * mtd->oobavail;
+	ops.len = 0;
+	ops.ooboffs = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = oob;
+	retval = mtd->read_oob(mtd, addr, &ops);
+
+	if (retval == 0) {
+		for (i = 0; i < dev->nChunksPerBlock; i++) {
+			memcpy(&pt, oob + i * mtd->oobavail, sizeof(pt));
+			yaffs_UnpackTags2(&tags[i], &pt);
+		}
+	}
+
+	return (retval == 0) ? YAFFS_OK : YAFFS_FAIL;
+#else
+	return YAFFS_FAIL;
+#endif
+}
+
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 {
 	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
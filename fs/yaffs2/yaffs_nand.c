@@ -90,6 +90,36 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 								       tags);
 }
 
+/*
+ * Read the tags of all the chunks in a block with a single request, which
+ * lets the NAND driver stream the spare areas instead of issuing a read
+ * command per chunk.  Returns YAFFS_FAIL if the driver can't do that, or if
+ * it reports an ECC problem it can't pin on a single chunk; the caller then
+ * reads the tags chunk by chunk.
+ */
+int yaffs_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockInNAND,
+					yaffs_ExtendedTags *tags)
+{
+	int i;
+
+	if (!dev->readBlockTagsFromNAND ||
+	    dev->readBlockTagsFromNAND(dev, blockInNAND - dev->blockOffset,
+				       tags) != YAFFS_OK)
+		return YAFFS_FAIL;
+
+	dev->nPageReads += dev->nChunksPerBlock;
+
+	for (i = 0; i < dev->nChunksPerBlock; i++) {
+		if (tags[i].eccResult > YAFFS_ECC_RESULT_NO_ERROR) {
+			yaffs_HandleChunkError(dev,
+					yaffs_GetBlockInfo(dev, blockInNAND));
+			break;
+		}
+	}
+
+	return YAFFS_OK;
+}
+
 int yaffs_MarkBlockBad(yaffs_Device *dev, int blockNo)
 {
 	blockNo -= dev->blockOffset;
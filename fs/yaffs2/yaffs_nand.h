@@ -28,6 +28,9 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 						const __u8 *buffer,
 						yaffs_ExtendedTags *tags);
 
+int yaffs_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockInNAND,
+					yaffs_ExtendedTags *tags);
+
 int yaffs_MarkBlockBad(yaffs_Device *dev, int blockNo);
 
 int yaffs_QueryInitialBlockState(yaffs_Device *dev,
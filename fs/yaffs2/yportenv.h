@@ -85,6 +85,9 @@
 #define Y_TIME_CONVERT(x) (x)
 #endif
 
+/* Millisecond clock, only used to time mounting */
+#define Y_TIME_MS() jiffies_to_msecs(jiffies)
+
 #define yaffs_SumCompare(x, y) ((x) == (y))
 #define yaffs_strcmp(a, b) strcmp(a, b)
 
@@ -196,6 +199,10 @@ extern unsigned int yaffs_wr_attempts;
 
 #define T(mask, p) do { if ((mask) & (yaffs_traceMask | YAFFS_TRACE_ALWAYS)) TOUT(p); } while (0)
 
+#ifndef Y_TIME_MS
+#define Y_TIME_MS() 0
+#endif
+
 #ifndef YBUG
 #define YBUG() do {T(YAFFS_TRACE_BUG, (TSTR("==>> yaffs bug: " __FILE__ " %d" TENDSTR), __LINE__)); } while (0)
 #endif
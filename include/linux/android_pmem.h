@@ -30,6 +30,8 @@
 	_IO(PMEM_KERNEL_TEST_MAGIC, 4)
 #define PMEM_KERNEL_TEST_LARGE_REGION_NUMBER_TEST_IOCTL \
 	_IO(PMEM_KERNEL_TEST_MAGIC, 5)
+#define PMEM_KERNEL_TEST_CHURN_TEST_IOCTL \
+	_IO(PMEM_KERNEL_TEST_MAGIC, 6)
 
 #define PMEM_IOCTL_MAGIC 'p'
 #define PMEM_GET_PHYS		_IOW(PMEM_IOCTL_MAGIC, 1, unsigned int)
@@ -92,6 +94,9 @@ void put_pmem_file(struct file* file);
 void put_pmem_fd(int fd);
 void flush_pmem_fd(int fd, unsigned long start, unsigned long len);
 void flush_pmem_file(struct file *file, unsigned long start, unsigned long len);
+void pmem_queue_flush(struct file *file, unsigned long start,
+		unsigned long len);
+void pmem_flush_queued(struct file *file);
 int pmem_cache_maint(struct file *file, unsigned int cmd,
 		struct pmem_addr *pmem_addr);
 
@@ -104,6 +109,7 @@ enum pmem_allocator_type {
 
 	PMEM_ALLOCATORTYPE_ALLORNOTHING,
 	PMEM_ALLOCATORTYPE_BUDDYBESTFIT,
+	PMEM_ALLOCATORTYPE_EXTENT,
 
 	PMEM_ALLOCATORTYPE_MAX,
 };
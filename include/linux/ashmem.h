@@ -32,6 +32,15 @@ struct ashmem_pin {
 	__u32 len;	/* length forward from offset, in bytes, page-aligned */
 };
 
+/* Returned by ASHMEM_GET_STATS */
+struct ashmem_stats {
+	__u32 purge_count;	/* times pages of this region were purged */
+	__u32 reserved;		/* pads the byte counts to 8 bytes */
+	__u64 unpinned_size;	/* bytes unpinned and not yet purged */
+	__u64 purged_size;	/* total bytes purged, in bytes */
+	__u64 last_purge_age;	/* msecs since the last purge, if any */
+};
+
 #define __ASHMEMIOC		0x77
 
 #define ASHMEM_SET_NAME		_IOW(__ASHMEMIOC, 1, char[ASHMEM_NAME_LEN])
@@ -44,5 +53,6 @@ struct ashmem_pin {
 #define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
 #define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
 #define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+#define ASHMEM_GET_STATS	_IOR(__ASHMEMIOC, 11, struct ashmem_stats)
 
 #endif	/* _LINUX_ASHMEM_H */
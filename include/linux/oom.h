@@ -13,6 +13,7 @@
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -30,6 +31,17 @@ extern void out_of_memory(struct zonelist *zonelist, gfp_t gfp_mask, int order);
 extern int register_oom_notifier(struct notifier_block *nb);
 extern int unregister_oom_notifier(struct notifier_block *nb);
 
+/* Events passed to oom_adj notifiers, along with the task */
+enum {
+	OOM_ADJ_FORK,		/* the task is a newly forked process */
+	OOM_ADJ_WRITE,		/* the task's oom_adj was written */
+	OOM_ADJ_EXIT,		/* the last thread of the task's process exits */
+};
+
+extern int register_oom_adj_notifier(struct notifier_block *nb);
+extern int unregister_oom_adj_notifier(struct notifier_block *nb);
+extern void oom_adj_notify(unsigned long event, struct task_struct *task);
+
 extern bool oom_killer_disabled;
 
 static inline void oom_killer_disable(void)
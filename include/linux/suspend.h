@@ -286,6 +286,23 @@ extern int unregister_pm_notifier(struct notifier_block *nb);
 		{ .notifier_call = fn, .priority = pri };	\
 	register_pm_notifier(&fn##_nb);			\
 }
+
+#define SUSPEND_STATS_NAME_LEN	32
+
+/* Outcome and timings of the system sleep transitions, for /proc */
+struct suspend_stats {
+	int	last_error;
+	char	failed_dev[SUSPEND_STATS_NAME_LEN];
+	s64	devices_suspend_us;	/* dpm_suspend_start() of the last run */
+	s64	devices_resume_us;	/* dpm_resume_end() of the last run */
+	s64	slowest_suspend_us;
+	char	slowest_suspend_dev[SUSPEND_STATS_NAME_LEN];
+	s64	slowest_resume_us;
+	char	slowest_resume_dev[SUSPEND_STATS_NAME_LEN];
+};
+
+/* drivers/base/power/main.c */
+extern struct suspend_stats suspend_stats;
 #else /* !CONFIG_PM_SLEEP */
 
 static inline int register_pm_notifier(struct notifier_block *nb)
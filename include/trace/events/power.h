@@ -5,6 +5,7 @@
 #define _TRACE_POWER_H
 
 #include <linux/ktime.h>
+#include <linux/device.h>
 #include <linux/tracepoint.h>
 
 #ifndef _TRACE_POWER_ENUM_
@@ -75,6 +76,97 @@ TRACE_EVENT(power_frequency,
 	TP_printk("type=%lu state=%lu", (unsigned long)__entry->type, (unsigned long) __entry->state)
 );
 
+TRACE_EVENT(wake_lock,
+
+	TP_PROTO(const char *name, int type, long timeout),
+
+	TP_ARGS(name, type, timeout),
+
+	TP_STRUCT__entry(
+		__string(	name,		name		)
+		__field(	int,		type		)
+		__field(	long,		timeout		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->type = type;
+		__entry->timeout = timeout;
+	),
+
+	TP_printk("name=%s type=%d timeout=%ld", __get_str(name),
+		  __entry->type, __entry->timeout)
+);
+
+TRACE_EVENT(wake_unlock,
+
+	TP_PROTO(const char *name, int expired),
+
+	TP_ARGS(name, expired),
+
+	TP_STRUCT__entry(
+		__string(	name,		name		)
+		__field(	int,		expired		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->expired = expired;
+	),
+
+	TP_printk("name=%s expired=%d", __get_str(name), __entry->expired)
+);
+
+TRACE_EVENT(suspend_resume,
+
+	TP_PROTO(const char *action, int val, bool start),
+
+	TP_ARGS(action, val, start),
+
+	TP_STRUCT__entry(
+		__field(	const char *,	action		)
+		__field(	int,		val		)
+		__field(	bool,		start		)
+	),
+
+	TP_fast_assign(
+		__entry->action = action;
+		__entry->val = val;
+		__entry->start = start;
+	),
+
+	TP_printk("%s[%d] %s", __entry->action, __entry->val,
+		  __entry->start ? "begin" : "end")
+);
+
+TRACE_EVENT(device_pm_callback,
+
+	TP_PROTO(struct device *dev, int pm_event, s64 usecs, int error),
+
+	TP_ARGS(dev, pm_event, usecs, error),
+
+	TP_STRUCT__entry(
+		__string(	device,		dev_name(dev)	)
+		__string(	driver,		dev->driver ?
+					dev->driver->name : "")
+		__field(	int,		pm_event	)
+		__field(	s64,		usecs		)
+		__field(	int,		error		)
+	),
+
+	TP_fast_assign(
+		__assign_str(device, dev_name(dev));
+		__assign_str(driver, dev->driver ? dev->driver->name : "");
+		__entry->pm_event = pm_event;
+		__entry->usecs = usecs;
+		__entry->error = error;
+	),
+
+	TP_printk("%s %s event=0x%x usecs=%lld error=%d",
+		  __get_str(driver), __get_str(device), __entry->pm_event,
+		  (long long)__entry->usecs, __entry->error)
+);
+
 #endif /* _TRACE_POWER_H */
 
 /* This part must be outside protection */
@@ -48,6 +48,7 @@
 #include <linux/fs_struct.h>
 #include <linux/init_task.h>
 #include <linux/perf_event.h>
+#include <linux/oom.h>
 #include <trace/events/sched.h>
 
 #include <asm/uaccess.h>
@@ -959,8 +960,11 @@ NORET_TYPE void do_exit(long code)
 
 	exit_mm(tsk);
 
-	if (group_dead)
+	if (group_dead) {
+		/* after exit_mm, so the memory is gone by the time we tell */
+		oom_adj_notify(OOM_ADJ_EXIT, tsk);
 		acct_process();
+	}
 	trace_sched_process_exit(tsk);
 
 	exit_sem(tsk);
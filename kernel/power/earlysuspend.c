@@ -13,10 +13,14 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -29,6 +33,9 @@ enum {
 };
 static int debug_mask = DEBUG_USER_STATE | DEBUG_SUSPEND;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
+static int async_handlers = 1;
+module_param_named(async_handlers, async_handlers, int,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
 
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
@@ -44,6 +51,50 @@ enum {
 };
 static int state;
 
+/* Handlers of one level run in parallel in this async domain */
+static LIST_HEAD(early_suspend_domain);
+static s64 early_suspend_us;
+static s64 late_resume_us;
+
+static void early_suspend_call(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start = ktime_get();
+
+	if (debug_mask & DEBUG_SUSPEND)
+		pr_info("early_suspend: handlers level=%d\n", h->level);
+	h->suspend(h);
+	h->suspend_us = ktime_to_us(ktime_sub(ktime_get(), start));
+}
+
+static void late_resume_call(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start = ktime_get();
+
+	if (debug_mask & DEBUG_SUSPEND)
+		pr_info("late_resume: handlers level=%d\n", h->level);
+	h->resume(h);
+	h->resume_us = ktime_to_us(ktime_sub(ktime_get(), start));
+}
+
+/* Caller must hold early_suspend_lock. Waits for the previous level before
+ * starting a handler of a new one.
+ */
+static void schedule_handler(async_func_ptr *func, struct early_suspend *h,
+			     int *level)
+{
+	if (!async_handlers) {
+		func(h, 0);
+		return;
+	}
+	if (h->level != *level) {
+		async_synchronize_full_domain(&early_suspend_domain);
+		*level = h->level;
+	}
+	async_schedule_domain(func, h, &early_suspend_domain);
+}
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
@@ -75,6 +126,8 @@ static void early_suspend(struct work_struct *work)
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level = INT_MIN;
+	ktime_t start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -93,14 +146,13 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
+	start = ktime_get();
 	list_for_each_entry(pos, &early_suspend_handlers, link) {
 		if (pos->suspend != NULL)
-		{
-			if (debug_mask & DEBUG_SUSPEND)
-                        	pr_info("early_suspend: handlers level=%d\n", pos->level);
-			pos->suspend(pos);
-		}
+			schedule_handler(early_suspend_call, pos, &level);
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	early_suspend_us = ktime_to_us(ktime_sub(ktime_get(), start));
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -123,6 +175,8 @@ static void late_resume(struct work_struct *work)
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level = INT_MIN;
+	ktime_t start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -139,17 +193,15 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
-	{
+	start = ktime_get();
+	list_for_each_entry_reverse(pos, &early_suspend_handlers, link) {
 		if (pos->resume != NULL)
-		{
-			if (debug_mask & DEBUG_SUSPEND)
-                                pr_info("late_resume: handlers level=%d\n", pos->level);
-			pos->resume(pos);
-		}
+			schedule_handler(late_resume_call, pos, &level);
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	late_resume_us = ktime_to_us(ktime_sub(ktime_get(), start));
 	if (debug_mask & DEBUG_SUSPEND)
-		pr_info("late_resume: done\n");
+		pr_info("late_resume: done in %lld us\n", late_resume_us);
 abort:
 	mutex_unlock(&early_suspend_lock);
 }
@@ -192,3 +244,43 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_stats_show(struct seq_file *m, void *unused)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(m, "early_suspend_us: %lld\nlate_resume_us: %lld\n",
+		   early_suspend_us, late_resume_us);
+	seq_puts(m, "level\tsuspend_us\tresume_us\thandler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(m, "%d\t%lld\t%lld\t%pf\n", pos->level,
+			   pos->suspend_us, pos->resume_us,
+			   pos->suspend ? (void *)pos->suspend :
+					  (void *)pos->resume);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_stats_show, NULL);
+}
+
+static const struct file_operations early_suspend_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = early_suspend_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init early_suspend_debugfs_init(void)
+{
+	debugfs_create_file("early_suspend_stats", S_IRUGO, NULL, NULL,
+			    &early_suspend_stats_fops);
+	return 0;
+}
+late_initcall(early_suspend_debugfs_init);
+#endif
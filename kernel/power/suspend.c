@@ -15,6 +15,8 @@
 #include <linux/console.h>
 #include <linux/cpu.h>
 #include <linux/syscalls.h>
+#include <linux/ktime.h>
+#include <trace/events/power.h>
 
 #include "power.h"
 
@@ -191,6 +193,7 @@ static int suspend_enter(suspend_state_t state)
  */
 int suspend_devices_and_enter(suspend_state_t state)
 {
+	ktime_t starttime;
 	int error;
 
 	if (!suspend_ops)
@@ -203,7 +206,12 @@ int suspend_devices_and_enter(suspend_state_t state)
 	}
 	suspend_console();
 	suspend_test_start();
+	trace_suspend_resume("dpm_suspend", state, true);
+	starttime = ktime_get();
 	error = dpm_suspend_start(PMSG_SUSPEND);
+	suspend_stats.devices_suspend_us =
+		ktime_to_us(ktime_sub(ktime_get(), starttime));
+	trace_suspend_resume("dpm_suspend", state, false);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to suspend\n");
 		goto Recover_platform;
@@ -212,11 +220,18 @@ int suspend_devices_and_enter(suspend_state_t state)
 	if (suspend_test(TEST_DEVICES))
 		goto Recover_platform;
 
-	suspend_enter(state);
+	trace_suspend_resume("suspend_enter", state, true);
+	error = suspend_enter(state);
+	trace_suspend_resume("suspend_enter", state, false);
 
  Resume_devices:
 	suspend_test_start();
+	trace_suspend_resume("dpm_resume", state, true);
+	starttime = ktime_get();
 	dpm_resume_end(PMSG_RESUME);
+	suspend_stats.devices_resume_us =
+		ktime_to_us(ktime_sub(ktime_get(), starttime));
+	trace_suspend_resume("dpm_resume", state, false);
 	suspend_test_finish("resume devices");
 	resume_console();
  Close:
@@ -269,6 +284,7 @@ int enter_state(suspend_state_t state)
 	printk("done.\n");
 
 	pr_debug("PM: Preparing system for %s sleep\n", pm_states[state]);
+	suspend_stats.failed_dev[0] = '\0';
 	error = suspend_prepare();
 	if (error)
 		goto Unlock;
@@ -283,6 +299,8 @@ int enter_state(suspend_state_t state)
 	pr_debug("PM: Finishing wakeup.\n");
 	suspend_finish();
  Unlock:
+	if (error)
+		suspend_stats.last_error = error;
 	mutex_unlock(&pm_mutex);
 	return error;
 }
@@ -23,6 +23,7 @@
 #endif
 #include "power.h"
 #include <linux/moduleparam.h>
+#include <trace/events/power.h>
 
 enum {
 	DEBUG_EXIT_SUSPEND = 1U << 0,
@@ -43,7 +44,11 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
+/* Active locks without a timeout come first, in no particular order,
+ * followed by the locks with a timeout sorted by expiry.
+ */
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+static int active_untimed_locks[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
@@ -80,6 +85,19 @@ static struct wake_lock deleted_wake_locks;
 static ktime_t last_sleep_time_update;
 static int wait_for_wakeup;
 
+/* Time asleep per attempt: <1s, 1-2s, 2-4s, ... and the rest */
+#define SLEEP_HISTOGRAM_SIZE	10
+
+/* Only touched by the suspend work, read by /proc/suspend_stats */
+static struct {
+	int attempts;
+	int wakelock_aborts;	/* a lock was taken before pm_suspend */
+	int late_aborts;	/* a lock was taken during pm_suspend */
+	int failures;
+	int successes;
+	int sleep_histogram[SLEEP_HISTOGRAM_SIZE];
+} suspend_attempt_stats;
+
 int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 {
 	struct timespec ts;
@@ -136,12 +154,13 @@ static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 	}
 
 	return seq_printf(m,
-		     "\"%s\"\t%d\t%d\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\n",
+		     "\"%s\"\t%d\t%d\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\t%d\n",
 		     lock->name, lock_count, expire_count,
 		     lock->stat.wakeup_count, ktime_to_ns(active_time),
 		     ktime_to_ns(total_time),
 		     ktime_to_ns(prevent_suspend_time), ktime_to_ns(max_time),
-		     ktime_to_ns(lock->stat.last_time));
+		     ktime_to_ns(lock->stat.last_time),
+		     lock->stat.abort_count);
 }
 
 static int wakelock_stats_show(struct seq_file *m, void *unused)
@@ -154,7 +173,8 @@ static int wakelock_stats_show(struct seq_file *m, void *unused)
 	spin_lock_irqsave(&list_lock, irqflags);
 
 	ret = seq_puts(m, "name\tcount\texpire_count\twake_count\tactive_since"
-			"\ttotal_time\tsleep_time\tmax_time\tlast_change\n");
+			"\ttotal_time\tsleep_time\tmax_time\tlast_change"
+			"\tsuspend_aborts\n");
 	list_for_each_entry(lock, &inactive_locks, link)
 		ret = print_lock_stat(m, lock);
 	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
@@ -165,6 +185,66 @@ static int wakelock_stats_show(struct seq_file *m, void *unused)
 	return 0;
 }
 
+static int suspend_stats_show(struct seq_file *m, void *unused)
+{
+	int i;
+
+	seq_printf(m, "attempts: %d\nsuccess: %d\nwakelock_abort: %d\n"
+		   "late_wakelock_abort: %d\nfail: %d\n",
+		   suspend_attempt_stats.attempts,
+		   suspend_attempt_stats.successes,
+		   suspend_attempt_stats.wakelock_aborts,
+		   suspend_attempt_stats.late_aborts,
+		   suspend_attempt_stats.failures);
+	seq_printf(m, "last_error: %d\nlast_failed_dev: %s\n",
+		   suspend_stats.last_error, suspend_stats.failed_dev);
+	seq_printf(m, "devices_suspend_us: %lld\ndevices_resume_us: %lld\n",
+		   suspend_stats.devices_suspend_us,
+		   suspend_stats.devices_resume_us);
+	seq_printf(m, "slowest_suspend: %s %lld\nslowest_resume: %s %lld\n",
+		   suspend_stats.slowest_suspend_dev,
+		   suspend_stats.slowest_suspend_us,
+		   suspend_stats.slowest_resume_dev,
+		   suspend_stats.slowest_resume_us);
+	seq_puts(m, "sleep_time_histogram:\n");
+	for (i = 0; i < SLEEP_HISTOGRAM_SIZE; i++) {
+		if (i == 0)
+			seq_printf(m, "\t<1s");
+		else if (i == SLEEP_HISTOGRAM_SIZE - 1)
+			seq_printf(m, "\t>=%ds", 1 << (i - 1));
+		else
+			seq_printf(m, "\t%d-%ds", 1 << (i - 1), 1 << i);
+		seq_printf(m, ": %d\n", suspend_attempt_stats.sleep_histogram[i]);
+	}
+	return 0;
+}
+
+/* Blame the suspend locks held when a suspend attempt had to give up */
+static void wake_lock_stat_abort(void)
+{
+	unsigned long irqflags;
+	struct wake_lock *lock;
+	ktime_t etime;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	list_for_each_entry(lock, &active_wake_locks[WAKE_LOCK_SUSPEND], link)
+		if (!get_expired_time(lock, &etime))
+			lock->stat.abort_count++;
+	spin_unlock_irqrestore(&list_lock, irqflags);
+}
+
+static void suspend_stat_sleep_time(struct timespec *before)
+{
+	struct timespec after;
+	unsigned long secs;
+	int bucket;
+
+	getnstimeofday(&after);
+	secs = after.tv_sec > before->tv_sec ? after.tv_sec - before->tv_sec : 0;
+	bucket = min_t(int, fls(secs), SLEEP_HISTOGRAM_SIZE - 1);
+	suspend_attempt_stats.sleep_histogram[bucket]++;
+}
+
 static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 {
 	ktime_t duration;
@@ -219,13 +299,40 @@ static void update_sleep_wait_stats_locked(int done)
 #endif
 
 
+/* Caller must acquire the list_lock spinlock */
+static void wake_lock_list_del_locked(struct wake_lock *lock)
+{
+	if ((lock->flags & (WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE)) ==
+	    WAKE_LOCK_ACTIVE)
+		active_untimed_locks[lock->flags & WAKE_LOCK_TYPE_MASK]--;
+	list_del(&lock->link);
+}
+
+/* Caller must acquire the list_lock spinlock. New timeouts nearly always
+ * end after the ones already running, so look for the spot from the tail.
+ */
+static void add_timed_wake_lock_locked(struct wake_lock *lock, int type)
+{
+	struct wake_lock *pos;
+
+	list_for_each_entry_reverse(pos, &active_wake_locks[type], link) {
+		if (!(pos->flags & WAKE_LOCK_AUTO_EXPIRE) ||
+		    (long)(lock->expires - pos->expires) >= 0) {
+			list_add(&lock->link, &pos->link);
+			return;
+		}
+	}
+	list_add(&lock->link, &active_wake_locks[type]);
+}
+
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	trace_wake_unlock(lock->name, 1);
+	wake_lock_list_del_locked(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
 	if (debug_mask & (DEBUG_WAKE_LOCK | DEBUG_EXPIRE))
 		pr_info("expired wake lock %s\n", lock->name);
@@ -257,20 +364,22 @@ static void print_active_locks(int type)
 static long has_wake_lock_locked(int type)
 {
 	struct wake_lock *lock, *n;
-	long max_timeout = 0;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
+	if (active_untimed_locks[type])
+		return -1;
+
+	/* Only timed locks left, soonest first */
 	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		expire_wake_lock(lock);
 	}
-	return max_timeout;
+	if (list_empty(&active_wake_locks[type]))
+		return 0;
+
+	lock = list_entry(active_wake_locks[type].prev, struct wake_lock, link);
+	return lock->expires - jiffies;
 }
 
 long has_wake_lock(int type)
@@ -346,10 +455,20 @@ static void suspend(struct work_struct *work)
 {
 	int ret;
 	int entry_event_num;
+#ifdef CONFIG_WAKELOCK_STAT
+	struct timespec before;
+	int late_aborts = suspend_attempt_stats.late_aborts;
+
+	suspend_attempt_stats.attempts++;
+#endif
 
 	if (has_wake_lock(WAKE_LOCK_SUSPEND)) {
 		if (debug_mask & DEBUG_SUSPEND)
 			pr_info("suspend: abort suspend\n");
+#ifdef CONFIG_WAKELOCK_STAT
+		suspend_attempt_stats.wakelock_aborts++;
+		wake_lock_stat_abort();
+#endif
 		return;
 	}
 #ifdef	CONFIG_ZTE_SUSPEND_WAKEUP_MONITOR
@@ -360,7 +479,20 @@ static void suspend(struct work_struct *work)
 	sys_sync();
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("suspend: enter suspend\n");
+#ifdef CONFIG_WAKELOCK_STAT
+	getnstimeofday(&before);
+#endif
+	trace_suspend_resume("pm_suspend", requested_suspend_state, true);
 	ret = pm_suspend(requested_suspend_state);
+	trace_suspend_resume("pm_suspend", ret, false);
+#ifdef CONFIG_WAKELOCK_STAT
+	if (!ret) {
+		suspend_attempt_stats.successes++;
+		suspend_stat_sleep_time(&before);
+	} else if (suspend_attempt_stats.late_aborts == late_aborts) {
+		suspend_attempt_stats.failures++;
+	}
+#endif
 	if (debug_mask & DEBUG_EXIT_SUSPEND) {
 		struct timespec ts;
 		struct rtc_time tm;
@@ -416,6 +548,10 @@ static int power_suspend_late(struct device *dev)
 	int ret = has_wake_lock(WAKE_LOCK_SUSPEND) ? -EAGAIN : 0;
 #ifdef CONFIG_WAKELOCK_STAT
 	wait_for_wakeup = 1;
+	if (ret) {
+		suspend_attempt_stats.late_aborts++;
+		wake_lock_stat_abort();
+	}
 #endif
 	if (debug_mask & DEBUG_SUSPEND)
 	{		
@@ -477,6 +613,7 @@ void wake_lock_destroy(struct wake_lock *lock)
 	if (lock->stat.count) {
 		deleted_wake_locks.stat.count += lock->stat.count;
 		deleted_wake_locks.stat.expire_count += lock->stat.expire_count;
+		deleted_wake_locks.stat.abort_count += lock->stat.abort_count;
 		deleted_wake_locks.stat.total_time =
 			ktime_add(deleted_wake_locks.stat.total_time,
 				  lock->stat.total_time);
@@ -488,7 +625,8 @@ void wake_lock_destroy(struct wake_lock *lock)
 				  lock->stat.max_time);
 	}
 #endif
-	list_del(&lock->link);
+	wake_lock_list_del_locked(lock);
+	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_destroy);
@@ -517,13 +655,14 @@ static void wake_lock_internal(
 		lock->stat.last_time = ktime_get();
 	}
 #endif
+	wake_lock_list_del_locked(lock);
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
 		lock->stat.last_time = ktime_get();
 #endif
 	}
-	list_del(&lock->link);
+	trace_wake_lock(lock->name, type, has_timeout ? timeout : 0);
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d, timeout %ld.%03lu\n",
@@ -531,13 +670,14 @@ static void wake_lock_internal(
 				(timeout % HZ) * MSEC_PER_SEC / HZ);
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
-		list_add_tail(&lock->link, &active_wake_locks[type]);
+		add_timed_wake_lock_locked(lock, type);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
 		list_add(&lock->link, &active_wake_locks[type]);
+		active_untimed_locks[type]++;
 	}
 	if (type == WAKE_LOCK_SUSPEND) {
 #ifdef	CONFIG_ZTE_SUSPEND_WAKEUP_MONITOR			
@@ -591,14 +731,20 @@ void wake_unlock(struct wake_lock *lock)
 	int type;
 	unsigned long irqflags;
 	spin_lock_irqsave(&list_lock, irqflags);
+	/* Drivers often unlock locks they don't hold, nothing changes then */
+	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
+		spin_unlock_irqrestore(&list_lock, irqflags);
+		return;
+	}
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 0);
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	trace_wake_unlock(lock->name, 0);
+	wake_lock_list_del_locked(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
 #ifdef	CONFIG_ZTE_SUSPEND_WAKEUP_MONITOR	
 	if (lock == &main_wake_lock) 
@@ -650,6 +796,19 @@ static const struct file_operations wakelock_stats_fops = {
 	.release = single_release,
 };
 
+static int suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_stats_show, NULL);
+}
+
+static const struct file_operations suspend_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = suspend_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init wakelocks_init(void)
 {
 	int ret;
@@ -692,6 +851,7 @@ static int __init wakelocks_init(void)
 
 #ifdef CONFIG_WAKELOCK_STAT
 	proc_create("wakelocks", S_IRUGO, NULL, &wakelock_stats_fops);
+	proc_create("suspend_stats", S_IRUGO, NULL, &suspend_stats_fops);
 #endif
 
 	return 0;
@@ -712,6 +872,7 @@ err_platform_device_register:
 static void  __exit wakelocks_exit(void)
 {
 #ifdef CONFIG_WAKELOCK_STAT
+	remove_proc_entry("suspend_stats", NULL);
 	remove_proc_entry("wakelocks", NULL);
 #endif
 	destroy_workqueue(suspend_work_queue);
@@ -18,6 +18,7 @@
 
 
 #include <linux/module.h>
+#include <linux/debugfs.h>
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
@@ -28,6 +29,10 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/rbtree.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,44 +42,73 @@
 
 /*
  * ashmem_area - anonymous shared memory area
- * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Lifecycle: From our parent file's open() until its release(), or until
+ *	the shrinker drops its reference if it is purging us at that time
+ * Locking: Protected by its own `lock'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct rb_root unpinned_root;	/* unpinned ranges, sorted by page */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	unsigned long unpinned_pages;	/* pages of ours on the LRU */
+	unsigned int purge_count;	/* times the shrinker purged us */
+	unsigned long purged_pages;	/* total pages purged */
+	unsigned long last_purge;	/* jiffies of the last purge */
+	struct mutex lock;		/* protects all of the above */
+	struct kref ref;		/* held by the file and the shrinker */
+	struct list_head entry;		/* entry in ashmem_area_list */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `lock'; `lru' also by `ashmem_lru_lock'
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
+	unsigned long unpinned_at;	/* jiffies when it was unpinned */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and lru_count
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->lock -> ashmem_lru_lock, and asma->lock -> i_mutex ->
+ * i_alloc_sem.  The shrinker only ever trylocks an area under ashmem_lru_lock.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/* All open areas, for debugfs.  Lock Ordering: before any asma->lock */
+static LIST_HEAD(ashmem_area_list);
+static DEFINE_MUTEX(ashmem_area_list_lock);
+
+/* Shrinker totals, protected by ashmem_lru_lock */
+static unsigned long ashmem_shrink_calls;
+static unsigned long ashmem_purged_ranges;
+static unsigned long ashmem_purged_pages;
+
+/*
+ * Ranges unpinned less than this long ago are likely to be pinned again
+ * soon, so the shrinker only purges them for requests of a similar size.
+ */
+static unsigned int ashmem_purge_min_age_ms = 1000;
+module_param_named(purge_min_age_ms, ashmem_purge_min_age_ms, uint,
+		   S_IRUGO | S_IWUSR);
+
+static struct dentry *ashmem_debugfs;
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -98,38 +132,85 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
   (page_in_range(range, start) || page_in_range(range, end) || \
    page_range_subsumes_range(range, start, end))
 
-#define range_before_page(range, page) \
-  ((range)->pgend < (page))
-
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
+/* Caller must hold ashmem_lru_lock. */
 static inline void lru_add(struct ashmem_range *range)
 {
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	range->asma->unpinned_pages += range_size(range);
 }
 
+/* Caller must hold ashmem_lru_lock. */
 static inline void lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
+	range->asma->unpinned_pages -= range_size(range);
+}
+
+static void ashmem_area_free(struct kref *ref)
+{
+	struct ashmem_area *asma = container_of(ref, struct ashmem_area, ref);
+
+	kmem_cache_free(ashmem_area_cachep, asma);
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *n = rb_next(&range->node);
+
+	return n ? rb_entry(n, struct ashmem_range, node) : NULL;
+}
+
+/*
+ * range_first_overlap - find the lowest unpinned range overlapping the pages
+ * [start, end], or NULL if there is none.  Ranges never overlap each other,
+ * so the tree is sorted by pgend as well as by pgstart.
+ *
+ * Caller must hold asma->lock.
+ */
+static struct ashmem_range *range_first_overlap(struct ashmem_area *asma,
+						size_t start, size_t end)
+{
+	struct rb_node *n = asma->unpinned_root.rb_node;
+	struct ashmem_range *found = NULL;
+
+	while (n) {
+		struct ashmem_range *range;
+
+		range = rb_entry(n, struct ashmem_range, node);
+		if (range->pgend >= start) {
+			found = range;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+
+	if (found && found->pgstart > end)
+		return NULL;
+	return found;
 }
 
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
+ * 'unpinned_at' - jiffies when the pages were unpinned
  *
- * Caller must hold ashmem_mutex.
+ * The new range must not overlap any range already in the area.
+ *
+ * Caller must hold asma->lock.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
-		       size_t start, size_t end)
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
+		       size_t start, size_t end, unsigned long unpinned_at)
 {
+	struct rb_node **p = &asma->unpinned_root.rb_node;
+	struct rb_node *parent = NULL;
 	struct ashmem_range *range;
 
 	range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
@@ -140,27 +221,43 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgstart = start;
 	range->pgend = end;
 	range->purged = purged;
+	range->unpinned_at = unpinned_at;
+
+	while (*p) {
+		parent = *p;
+		if (start < rb_entry(parent, struct ashmem_range, node)->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned_root);
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
-
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_add(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 
 	return 0;
 }
 
+/* Caller must hold asma->lock. */
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
-	if (range_on_lru(range))
+	rb_erase(&range->node, &range->asma->unpinned_root);
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 	kmem_cache_free(ashmem_range_cachep, range);
 }
 
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -170,8 +267,12 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		range->asma->unpinned_pages -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -187,27 +288,37 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	asma->unpinned_root = RB_ROOT;
+	mutex_init(&asma->lock);
+	kref_init(&asma->ref);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
 
+	mutex_lock(&ashmem_area_list_lock);
+	list_add_tail(&asma->entry, &ashmem_area_list);
+	mutex_unlock(&ashmem_area_list_lock);
+
 	return 0;
 }
 
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *n;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&ashmem_area_list_lock);
+	list_del(&asma->entry);
+	mutex_unlock(&ashmem_area_list_lock);
+
+	mutex_lock(&asma->lock);
+	while ((n = rb_first(&asma->unpinned_root)) != NULL)
+		range_del(rb_entry(n, struct ashmem_range, node));
+	mutex_unlock(&asma->lock);
 
 	if (asma->file)
 		fput(asma->file);
-	kmem_cache_free(ashmem_area_cachep, asma);
+	kref_put(&asma->ref, ashmem_area_free);
 
 	return 0;
 }
@@ -224,7 +335,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -267,10 +378,89 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
+/*
+ * range_purgeable - should the shrinker purge 'range' to free 'nr_to_scan'
+ * more pages?  Old ranges always, recently unpinned ones only if that would
+ * not free much more than was asked for.
+ */
+static inline int range_purgeable(struct ashmem_range *range, int nr_to_scan)
+{
+	unsigned long age = jiffies - range->unpinned_at;
+
+	if (age >= msecs_to_jiffies(ashmem_purge_min_age_ms))
+		return 1;
+	return range_size(range) <= 2 * (unsigned long)nr_to_scan;
+}
+
+/*
+ * ashmem_purge - purge unpinned ranges until 'nr_to_scan' pages are freed
+ *
+ * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
+ * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
+ * pages freed.  Unless 'force' is set, recently unpinned ranges are left
+ * alone when they are much bigger than what is left to free.  Areas that are
+ * busy (being pinned, unpinned or mapped) are skipped rather than waited on,
+ * and no global lock is held while we truncate, so pin and unpin on other
+ * areas proceed in parallel.
+ *
+ * Return value is the number of pages remaining on the LRU.
+ */
+static int ashmem_purge(int nr_to_scan, int force)
+{
+	struct ashmem_range *range;
+
+	spin_lock(&ashmem_lru_lock);
+	ashmem_shrink_calls++;
+	while (nr_to_scan > 0) {
+		struct ashmem_area *asma = NULL;
+		struct inode *inode;
+		loff_t start, end;
+
+		list_for_each_entry(range, &ashmem_lru_list, lru) {
+			if (!force && !range_purgeable(range, nr_to_scan))
+				continue;
+			if (mutex_trylock(&range->asma->lock)) {
+				asma = range->asma;
+				break;
+			}
+		}
+		if (!asma)
+			break;
+
+		/*
+		 * The range cannot change while we hold asma->lock, and the
+		 * reference keeps asma around until we have unlocked it.
+		 */
+		kref_get(&asma->ref);
+		range->purged = ASHMEM_WAS_PURGED;
+		lru_del(range);
+		nr_to_scan -= range_size(range);
+		ashmem_purged_ranges++;
+		ashmem_purged_pages += range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+
+		asma->purge_count++;
+		asma->purged_pages += range_size(range);
+		asma->last_purge = jiffies;
+
+		inode = asma->file->f_dentry->d_inode;
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
+		vmtruncate_range(inode, start, end);
+
+		mutex_unlock(&asma->lock);
+		kref_put(&asma->ref, ashmem_area_free);
+		spin_lock(&ashmem_lru_lock);
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	return lru_count;
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -281,38 +471,16 @@ out:
  *
  * Return value is the number of objects (pages) remaining, or -1 if we cannot
  * proceed without risk of deadlock (due to gfp_mask).
- *
- * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
- * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
  */
 static int ashmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 {
-	struct ashmem_range *range, *next;
-
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (nr_to_scan && !(gfp_mask & __GFP_FS))
 		return -1;
 	if (!nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
-
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
-		nr_to_scan -= range_size(range);
-		if (nr_to_scan <= 0)
-			break;
-	}
-	mutex_unlock(&ashmem_mutex);
-
-	return lru_count;
+	return ashmem_purge(nr_to_scan, 0);
 }
 
 static struct shrinker ashmem_shrinker = {
@@ -324,7 +492,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -339,7 +507,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -347,7 +515,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -361,7 +529,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -370,7 +538,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -387,7 +555,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -396,17 +564,16 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	range = range_first_overlap(asma, pgstart, pgend);
+	for (; range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
@@ -449,8 +616,8 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 			 * more complicated, we allocate a new range for the
 			 * second half and adjust the first chunk's endpoint.
 			 */
-			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
+			range_alloc(asma, range->purged, pgend + 1,
+				    range->pgend, range->unpinned_at);
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
 		}
@@ -462,18 +629,20 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
+	/*
+	 * Ranges never overlap, so growing [pgstart, pgend] to cover one
+	 * overlapping range can never make it reach a range we have not seen.
+	 */
+	range = range_first_overlap(asma, pgstart, pgend);
+	for (; range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to unpin pages that are already entirely
@@ -481,40 +650,49 @@ restart:
 		 */
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+		pgstart = min_t(size_t, range->pgstart, pgstart),
+		pgend = max_t(size_t, range->pgend, pgend);
+		purged |= range->purged;
+		range_del(range);
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend, jiffies);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
+	if (range_first_overlap(asma, pgstart, pgend))
+		return ASHMEM_IS_UNPINNED;
 
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	return ASHMEM_IS_PINNED;
+}
 
-	return ret;
+static int get_stats(struct ashmem_area *asma, void __user *p)
+{
+	struct ashmem_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+
+	mutex_lock(&asma->lock);
+	stats.purge_count = asma->purge_count;
+	stats.unpinned_size = (__u64) asma->unpinned_pages << PAGE_SHIFT;
+	stats.purged_size = (__u64) asma->purged_pages << PAGE_SHIFT;
+	if (asma->purge_count)
+		stats.last_purge_age = jiffies_to_msecs(jiffies -
+							asma->last_purge);
+	mutex_unlock(&asma->lock);
+
+	if (unlikely(copy_to_user(p, &stats, sizeof(stats))))
+		return -EFAULT;
+
+	return 0;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -546,7 +724,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -560,7 +738,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -598,11 +776,14 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_pin_unpin(asma, cmd, (void __user *) arg);
 		break;
+	case ASHMEM_GET_STATS:
+		ret = get_stats(asma, (void __user *) arg);
+		break;
 	case ASHMEM_PURGE_ALL_CACHES:
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
 			ret = ashmem_shrink(0, GFP_KERNEL);
-			ashmem_shrink(ret, GFP_KERNEL);
+			ashmem_purge(ret, 1);
 		}
 		break;
 	}
@@ -610,6 +791,58 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+static int ashmem_debug_show(struct seq_file *m, void *unused)
+{
+	struct ashmem_area *asma;
+
+	spin_lock(&ashmem_lru_lock);
+	seq_printf(m, "unpinned: %lu pages\n"
+		   "purged: %lu pages in %lu ranges over %lu shrinker calls\n",
+		   lru_count, ashmem_purged_pages, ashmem_purged_ranges,
+		   ashmem_shrink_calls);
+	spin_unlock(&ashmem_lru_lock);
+
+	seq_printf(m, "%-32s %10s %10s %8s %10s %12s\n", "name", "size",
+		   "unpinned", "purges", "purged", "last purge");
+	mutex_lock(&ashmem_area_list_lock);
+	list_for_each_entry(asma, &ashmem_area_list, entry) {
+		mutex_lock(&asma->lock);
+		if (asma->unpinned_pages || asma->purge_count) {
+			char *name = ASHMEM_NAME_DEF;
+
+			if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0')
+				name = asma->name + ASHMEM_NAME_PREFIX_LEN;
+			seq_printf(m, "%-32s %10zu %10lu %8u %10lu", name,
+				   asma->size,
+				   asma->unpinned_pages << PAGE_SHIFT,
+				   asma->purge_count,
+				   asma->purged_pages << PAGE_SHIFT);
+			if (asma->purge_count)
+				seq_printf(m, " %9ums ago\n",
+					   jiffies_to_msecs(jiffies -
+							    asma->last_purge));
+			else
+				seq_printf(m, " %12s\n", "never");
+		}
+		mutex_unlock(&asma->lock);
+	}
+	mutex_unlock(&ashmem_area_list_lock);
+
+	return 0;
+}
+
+static int ashmem_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_debug_show, inode->i_private);
+}
+
+static const struct file_operations ashmem_debug_fops = {
+	.open = ashmem_debug_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static struct file_operations ashmem_fops = {
 	.owner = THIS_MODULE,
 	.open = ashmem_open,
@@ -653,6 +886,9 @@ static int __init ashmem_init(void)
 
 	register_shrinker(&ashmem_shrinker);
 
+	ashmem_debugfs = debugfs_create_file("ashmem", S_IRUGO, NULL, NULL,
+					     &ashmem_debug_fops);
+
 	printk(KERN_INFO "ashmem: initialized\n");
 
 	return 0;
@@ -662,6 +898,7 @@ static void __exit ashmem_exit(void)
 {
 	int ret;
 
+	debugfs_remove(ashmem_debugfs);
 	unregister_shrinker(&ashmem_shrinker);
 
 	ret = misc_deregister(&ashmem_misc);
@@ -469,6 +469,30 @@ int unregister_oom_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_oom_notifier);
 
+static BLOCKING_NOTIFIER_HEAD(oom_adj_notify_list);
+
+int register_oom_adj_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_oom_adj_notifier);
+
+int unregister_oom_adj_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_oom_adj_notifier);
+
+/*
+ * Tell anyone keeping track of processes by oom_adj that @task was forked,
+ * had its oom_adj written or is exiting, see OOM_ADJ_*.  The caller must
+ * hold a reference on @task and be able to sleep.
+ */
+void oom_adj_notify(unsigned long event, struct task_struct *task)
+{
+	blocking_notifier_call_chain(&oom_adj_notify_list, event, task);
+}
+
 /*
  * Try to acquire the OOM killer lock for the zones in zonelist.  Returns zero
  * if a parallel OOM killing is already taking place that includes a zone in
@@ -2207,6 +2207,25 @@ static int kswapd(void *p)
 	return 0;
 }
 
+static ATOMIC_NOTIFIER_HEAD(kswapd_wakeup_notifier);
+
+/*
+ * Called with the zone and order whenever an allocation finds a zone below
+ * its low watermark, whether or not kswapd was already awake.  Runs in the
+ * allocator's context, so callbacks must not sleep or allocate.
+ */
+int register_kswapd_wakeup_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&kswapd_wakeup_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(register_kswapd_wakeup_notifier);
+
+int unregister_kswapd_wakeup_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&kswapd_wakeup_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_kswapd_wakeup_notifier);
+
 /*
  * A zone is low on free memory, so wake its kswapd task to service it.
  */
@@ -2220,6 +2239,7 @@ void wakeup_kswapd(struct zone *zone, int order)
 	pgdat = zone->zone_pgdat;
 	if (zone_watermark_ok(zone, order, low_wmark_pages(zone), 0, 0))
 		return;
+	atomic_notifier_call_chain(&kswapd_wakeup_notifier, order, zone);
 	if (pgdat->kswapd_max_order < order)
 		pgdat->kswapd_max_order = order;
 	if (!cpuset_zone_allowed_hardwall(zone, GFP_KERNEL))